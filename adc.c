@@ -1,7 +1,80 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
 #include "config.h"
 #include "adc.h"
+#include "fault.h"
+#include "scope.h"
+#include "prof.h"
+
+/* Conversions are started by timer 1 in the middle of the on-time of the
+ * bridges, where the current is at the centre of its ripple. Timer 0 runs
+ * in step, see motor.c. The trigger is the rising edge of a flag, which
+ * has to be cleared for the next one.
+ *
+ * That is one conversion per PWM period, and the entries of the scan take
+ * turns, so each motor is sampled every other period, 76 Hz at the 153 Hz
+ * default, a little less on the passes with a slow input. Above about
+ * 12 kHz a conversion, 83 us, outlasts the period and triggers are
+ * skipped, at 39 kHz a motor is sampled every 8th period or so. */
+#if DISABLE_PWM
+    /* The disable pin is low, the bridge on, around TOP. With ICR1 as TOP
+     * the input capture flag is set there. */
+    #define ADC_TRIGGER         ((1<<ADTS2) | (1<<ADTS1) | (1<<ADTS0))
+    #define ADC_TRIGGER_FLAG    (1<<ICF1)
+#else
+    /* The inputs are high around BOTTOM, where timer 1 overflows. */
+    #define ADC_TRIGGER         ((1<<ADTS2) | (1<<ADTS1))
+    #define ADC_TRIGGER_FLAG    (1<<TOV1)
+#endif /* DISABLE_PWM */
+
+#define ADC_PRESCALER_MASK  ((1<<ADPS2) | (1<<ADPS1) | (1<<ADPS0))
+
+/* Voltage references, the REFS1 and REFS0 bits of ADMUX. */
+#define ADC_REF_MASK        ((1<<REFS1) | (1<<REFS0))
+#define ADC_REF_AVCC        (1<<REFS0)
+#define ADC_REF_1V1         (1<<REFS1)
+#define ADC_REF_2V56        ((1<<REFS1) | (1<<REFS0))
+
+/* One conversion of the scan. */
+typedef struct adcScanEntry_ {
+    uint8_t mux;        /* MUX4..0, the channel. */
+    uint8_t ref;        /* ADC_REF_*. */
+    uint8_t weight;     /* Converted every weight-th pass, a power of 2. */
+    uint8_t slot;       /* ADC_SLOT_* the result goes to. */
+} adcScanEntry;
+
+/* The scan, one conversion per trigger. The current feedback is converted
+ * every pass, the other inputs are fitted in between at lower rates, on
+ * different passes by their position. A change of reference costs a
+ * conversion, see adcNext(), and the reference pin takes a while to
+ * settle with its capacitor, so keep to one where possible. */
+static const adcScanEntry adcScan[] PROGMEM = {
+    /* mux, ref, weight, slot */
+    { M1_FEEDBACKADC, ADC_REF_2V56, 1, ADC_SLOT_M1 },
+    { M2_FEEDBACKADC, ADC_REF_2V56, 1, ADC_SLOT_M2 },
+#ifdef VBAT_ADC
+    { VBAT_ADC, ADC_REF_2V56, ADC_SLOW_WEIGHT, ADC_SLOT_VBAT },
+#endif /* VBAT_ADC */
+#ifdef TEMP_ADC
+    { TEMP_ADC, ADC_REF_2V56, ADC_SLOW_WEIGHT, ADC_SLOT_TEMP },
+#endif /* TEMP_ADC */
+};
+
+#define ADC_SCAN_LENGTH     (sizeof(adcScan) / sizeof(adcScan[0]))
+
+static uint8_t adcCapturing;
+static uint8_t adcIndex;        /* Entry of the conversion under way. */
+static uint8_t adcSlot;         /* Its slot. */
+static uint8_t adcPass;
+static uint8_t adcSettle;       /* Drop the result, the reference changed. */
+
+/* The slow inputs, ADC_FRACTION_BITS, the slots sampled at all, one bit
+ * each, and the slots updated since adcPoll(). */
+static uint16_t adcSlots[ADC_SLOTS];
+static uint8_t adcValid;
+static volatile uint8_t adcUpdated;
 
 void initAdc(void) {
     /* Setups the ADC for use. 
@@ -10,20 +83,58 @@ void initAdc(void) {
     /* Select the 2.56V internal reference. */
     ADMUX |= ((1<<REFS1) | (1<<REFS0));
 
-    /* Using the largest ADC prescaler (/128) since time is not an issue. */
-    ADCSRA |= ((1<<ADPS2) | (1<<ADPS1) | (1<<ADPS0));
- 
-    /* Enable the ADC and Interrupt Enable. */
-    ADCSRA |= (1<<ADEN) | (1<<ADIE);
-    
+    /* Using the largest ADC prescaler (/128), a conversion takes 83 us and
+     * is done well within the shortest on-time worth measuring. */
+    ADCSRA |= ADC_PRESCALER_MASK;
+
     /* Disable the digital part of the feedback pins. */
     DIDR0 |= (M1_FEEDBACK | M2_FEEDBACK);
+#ifdef VBAT_ADC
+    DIDR0 |= (1<<VBAT_ADC);
+#endif /* VBAT_ADC */
+#ifdef TEMP_ADC
+    DIDR0 |= (1<<TEMP_ADC);
+#endif /* TEMP_ADC */
     
-    /* Start with Motor 1 Feedback for first conversion. */
+    /* Start with Motor 1 Feedback for first conversion, the first entry
+     * of the scan. */
     ADMUX |= M1_FEEDBACKADC;
-    
-    /* Start conversion. */
-    ADCSRA |= (1<<ADSC);
+
+    /* Enable the ADC, Interrupt Enable and Auto Trigger from timer 1.
+     * The first conversion starts at the next trigger, see the top of
+     * the file for the rate. */
+    ADCSRB = (ADCSRB & ~((1<<ADTS2) | (1<<ADTS1) | (1<<ADTS0))) | ADC_TRIGGER;
+    TIFR1 = ADC_TRIGGER_FLAG;
+    ADCSRA |= (1<<ADEN) | (1<<ADIE) | (1<<ADATE);
+}
+
+void adcCapture(uint8_t bits) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        /* ADIF is cleared by writing a one, keep it out of the writes. */
+        uint8_t adcsra = ADCSRA & ~((1<<ADIF) | (1<<ADATE) | ADC_PRESCALER_MASK);
+
+        if (bits) {
+            /* Back to back conversions restarted by the interrupt. The
+             * ADC clock is beyond the 200 kHz of full accuracy, 625 kHz
+             * (/32) for 8 bits and 312 kHz (/64) for 10. */
+            if (bits == 8) {
+                ADMUX |= (1<<ADLAR);
+                adcsra |= (1<<ADPS2) | (1<<ADPS0);
+            } else {
+                ADMUX &= ~(1<<ADLAR);
+                adcsra |= (1<<ADPS2) | (1<<ADPS1);
+            }
+            adcCapturing = 1;
+            /* A conversion under way finishes first, its interrupt
+             * restarts then. */
+            ADCSRA = adcsra | (1<<ADSC);
+        } else {
+            adcCapturing = 0;
+            ADMUX &= ~(1<<ADLAR);
+            TIFR1 = ADC_TRIGGER_FLAG;
+            ADCSRA = adcsra | ADC_PRESCALER_MASK | (1<<ADATE);
+        }
+    }
 }
 
 uint16_t getADCVal(void) {
@@ -37,18 +148,195 @@ uint16_t getADCVal(void) {
 uint8_t curAdc = M1_FEEDBACKADC;
 uint16_t lastAdcValM1;
 uint16_t lastAdcValM2;
+volatile uint8_t adcSamples[2];
 
-ISR(ADC_vect) {
-    if ((ADMUX & 0x1F) == M1_FEEDBACKADC) {
-        lastAdcValM1 = getADCVal();
-        curAdc = M2_FEEDBACKADC; /* Set M2 ADC for next conversion. */
-    } else if ((ADMUX & 0x1F) == M2_FEEDBACKADC) {
-        lastAdcValM2 = getADCVal();
-        curAdc = M1_FEEDBACKADC; /* Set M1 ADC for next conversion. */
+/* Filter state of one feedback channel. */
+typedef struct adcChannel_ {
+    uint16_t sum;       /* Samples of the current block, at most 64. */
+    uint8_t count;
+    uint16_t block;     /* Sum of the last block, see adcGetAvg(). */
+    uint8_t blockLog4;  /* Its length. */
+    int32_t filt;       /* IIR state, ADC_FRACTION_BITS + 8. */
+} adcChannel;
+
+static adcChannel adcChannels[2];
+
+/* Block length as a power of 4, 4^n samples give n more bits. */
+static uint8_t adcOversampleLog4 = ADC_OVERSAMPLE_LOG4;
+static uint8_t adcBlockLength = 1 << (2 * ADC_OVERSAMPLE_LOG4);
+static uint8_t adcFilterShift = ADC_FILTER_SHIFT;
+
+static inline void adcFilter(adcChannel *channel, uint16_t sample) {
+    /* Called by the ADC interrupt with every sample of a channel. AVR
+     * shifts by a variable count one bit at a time in a loop, so the
+     * shifts here are all by constants, the block is scaled later. */
+    int32_t delta = ((int32_t)sample << (ADC_FRACTION_BITS + 8)) - channel->filt;
+
+    /* First order low-pass, y += (x - y) / 2^shift. */
+    switch (adcFilterShift) {
+        case 1: delta >>= 1; break;
+        case 2: delta >>= 2; break;
+        case 3: delta >>= 3; break;
+        case 4: delta >>= 4; break;
+        case 5: delta >>= 5; break;
+        case 6: delta >>= 6; break;
+        case 7: delta >>= 7; break;
+        case 8: delta >>= 8; break;
+    }
+    channel->filt += delta;
+
+    /* Oversample and decimate. */
+    channel->sum += sample;
+    if (++channel->count >= adcBlockLength) {
+        channel->block = channel->sum;
+        channel->blockLog4 = adcOversampleLog4;
+        channel->sum = 0;
+        channel->count = 0;
+    }
+}
+
+static void adcNext(void) {
+    /* Selects the next entry of the scan for the next conversion. The
+     * first entry is converted every pass, so the search ends. While
+     * capturing only the current feedback is converted. */
+    adcScanEntry entry;
+    uint8_t weight;
+
+    do {
+        if (++adcIndex >= ADC_SCAN_LENGTH) {
+            adcIndex = 0;
+            adcPass++;
+        }
+        weight = pgm_read_byte(&adcScan[adcIndex].weight);
+    } while ((adcCapturing && (weight > 1)) || ((adcPass + adcIndex) & (weight - 1)));
+
+    memcpy_P(&entry, &adcScan[adcIndex], sizeof(entry));
+    adcSlot = entry.slot;
+    /* The first conversion after a change of reference is off. */
+    if ((ADMUX & ADC_REF_MASK) != entry.ref) adcSettle = 1;
+    curAdc = entry.mux;
+    ADMUX = (ADMUX & ~(ADC_REF_MASK | 0x1F)) | entry.ref | (0x1F & entry.mux);
+}
+
+static inline void adcSlow(uint8_t slot, uint16_t sample) {
+    /* Low-passes a slow input over about 4 samples, starting from the
+     * first one. */
+    uint16_t x = sample << ADC_FRACTION_BITS;
+
+    if (adcValid & (1<<slot)) {
+        adcSlots[slot] += ((int16_t)(x - adcSlots[slot])) >> 2;
+    } else {
+        adcSlots[slot] = x;
+        adcValid |= (1<<slot);
     }
-    ADMUX &= ~0x1F; /* Set MUX4..0 to zero. */
-    ADMUX |= (0x1F & curAdc); /* Set M2 ADC for next conversion. */
-    ADCSRA |= (1<<ADSC); /* Start conversion. */
+    adcUpdated |= (1<<slot);
+}
+
+uint16_t adcGetSlot(uint8_t slot) {
+    uint16_t value;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        value = adcSlots[slot];
+    }
+    return value;
+}
+
+uint8_t adcPoll(void) {
+    uint8_t updated;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        updated = adcUpdated;
+        adcUpdated = 0;
+    }
+    return updated;
+}
+
+uint16_t adcGetAvg(uint8_t motor) {
+    uint16_t block;
+    uint8_t log4;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        block = adcChannels[motor - 1].block;
+        log4 = adcChannels[motor - 1].blockLog4;
+    }
+    return ((uint32_t)block << ADC_FRACTION_BITS) >> (2 * log4);
+}
+
+uint16_t adcGetFilt(uint8_t motor) {
+    int32_t filt;
 
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        filt = adcChannels[motor - 1].filt;
+    }
+    return filt >> 8;
+}
+
+void adcSetOversample(uint8_t log4) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        /* Start new blocks, the old ones had a different length. */
+        adcOversampleLog4 = log4;
+        adcBlockLength = 1 << (2 * log4);
+        adcChannels[0].sum = 0;
+        adcChannels[0].count = 0;
+        adcChannels[1].sum = 0;
+        adcChannels[1].count = 0;
+    }
+}
+
+uint8_t adcGetOversample(void) {
+    return adcOversampleLog4;
+}
+
+void adcSetFilter(uint8_t shift) {
+    adcFilterShift = shift;
+}
+
+uint8_t adcGetFilter(void) {
+    return adcFilterShift;
+}
+
+ISR(ADC_vect) {
+    uint16_t sample;
+    uint8_t motor = 0;
+
+    PROF_BEGIN(PROF_ADC);
+    /* Left adjusted while capturing 8 bit samples. */
+    if (ADMUX & (1<<ADLAR)) {
+        sample = (uint16_t)ADCH << 2;
+    } else {
+        sample = getADCVal();
+    }
+    if (adcSettle) {
+        /* Dropped, the same entry goes again. */
+        adcSettle = 0;
+    } else {
+        if (adcSlot == ADC_SLOT_M1) {
+            lastAdcValM1 = sample;
+            adcSamples[0]++;
+            faultCheckCurrent(&faultCurrents[0], lastAdcValM1);
+            adcFilter(&adcChannels[0], lastAdcValM1);
+            motor = 1;
+        } else if (adcSlot == ADC_SLOT_M2) {
+            lastAdcValM2 = sample;
+            adcSamples[1]++;
+            faultCheckCurrent(&faultCurrents[1], lastAdcValM2);
+            adcFilter(&adcChannels[1], lastAdcValM2);
+            motor = 2;
+        } else {
+            adcSlow(adcSlot, sample);
+        }
+        adcNext();
+    }
+    if (adcCapturing) {
+        if (scopeSample(motor, sample)) {
+            adcCapture(0);
+        } else {
+            ADCSRA |= (1<<ADSC); /* Start conversion. */
+        }
+    } else {
+        /* Arm the trigger, the entries take turns, one per PWM period. */
+        TIFR1 = ADC_TRIGGER_FLAG;
+    }
+    PROF_END(PROF_ADC);
 }
 
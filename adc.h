@@ -5,8 +5,59 @@ void initAdc(void);
 
 uint16_t getADCVal(void);
 
-uint8_t curAdc;
-uint16_t lastAdcValM1;
-uint16_t lastAdcValM2;
+/* Slots of the scan, each input has its own, see adcScan in adc.c. The
+ * battery and temperature inputs are optional, see config.h. */
+#define ADC_SLOT_M1         0
+#define ADC_SLOT_M2         1
+#define ADC_SLOT_VBAT       2
+#define ADC_SLOT_TEMP       3
+#define ADC_SLOTS           4
+
+/* Channel of the next conversion. */
+extern uint8_t curAdc;
+
+/* Raw 10-bit samples of the current feedback, the latest of each motor. */
+extern uint16_t lastAdcValM1;
+extern uint16_t lastAdcValM2;
+
+/* Samples taken of motor 1 and 2, wrapping, tells a new sample from the
+ * last one. */
+extern volatile uint8_t adcSamples[2];
+
+/* The filtered values below have this many fraction bits, they are raw
+ * samples times 8, 13 bits. */
+#define ADC_FRACTION_BITS   3
+
+/* Mean of the last block of samples of motor 1 or 2, see
+ * adcSetOversample(). Noise permitting a block of 4^n samples adds n
+ * bits of resolution, up to ADC_FRACTION_BITS. */
+uint16_t adcGetAvg(uint8_t motor);
+
+/* First order low-pass of the samples of motor 1 or 2, see adcSetFilter(). */
+uint16_t adcGetFilt(uint8_t motor);
+
+/* Latest value of a slow input, ADC_SLOT_VBAT or ADC_SLOT_TEMP, low-passed
+ * and with ADC_FRACTION_BITS. 0 until the first sample. */
+uint16_t adcGetSlot(uint8_t slot);
+
+/* Returns the slots of the slow inputs updated since the last call, one
+ * bit each, 1<<ADC_SLOT_VBAT for the battery. */
+uint8_t adcPoll(void);
+
+/* Sets the block length of adcGetAvg() to 4^log4 samples, 0:1:3 for 1,
+ * 4, 16 or 64 samples. Each motor is sampled every other PWM period,
+ * less the odd one the slow inputs take. */
+void adcSetOversample(uint8_t log4);
+uint8_t adcGetOversample(void);
+
+/* Switches the ADC to back to back conversions of bits (8 or 10) for a
+ * capture, see scope.h, or back to the timer trigger with 0. The filters
+ * see the samples at the faster rate meanwhile. */
+void adcCapture(uint8_t bits);
+
+/* Sets the time constant of adcGetFilt() to 2^shift samples, 0:1:8,
+ * 0 passes the samples unfiltered. */
+void adcSetFilter(uint8_t shift);
+uint8_t adcGetFilter(void);
 
 #endif /* ADC_H_ */
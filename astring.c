@@ -0,0 +1,128 @@
+#include <stdint.h>
+#include "astring.h"
+
+uint8_t strTokenize(uint8_t *str, strToken *tokens, uint8_t maxTokens) {
+    /* Single pass over the string, no copying. */
+    uint8_t count = 0;
+    uint8_t *start = 0;
+
+    for (;; str++) {
+        if ((*str == ' ') || (*str == '\0')) {
+            if (start) {
+                /* End of a token. */
+                if (count < maxTokens) {
+                    tokens[count].str = start;
+                    tokens[count].len = str - start;
+                }
+                count++;
+                start = 0;
+            }
+            if (*str == '\0') break;
+            *str = '\0';
+        } else if (!start) {
+            start = str;
+        }
+    }
+    return count;
+}
+
+static uint8_t strDigit(uint8_t c, uint8_t base) {
+    /* Returns the value of a digit, or base if it is not one. */
+    uint8_t digit;
+
+    if ((c >= '0') && (c <= '9')) {
+        digit = c - '0';
+    } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+        digit = (c | 0x20) - 'a' + 10;
+    } else {
+        return base;
+    }
+    return (digit < base) ? digit : base;
+}
+
+uint8_t strParseInt32(const uint8_t *str, int32_t *value) {
+    uint8_t negative = 0;
+    uint8_t base = 10;
+    uint8_t digit;
+    uint32_t result = 0;
+    uint32_t limit;
+
+    if (*str == '-') {
+        negative = 1;
+        str++;
+    } else if (*str == '+') {
+        str++;
+    }
+    if ((str[0] == '0') && ((str[1] | 0x20) == 'x')) {
+        base = 16;
+        str += 2;
+    }
+    if (*str == '\0') return STR_ERR_SYNTAX;
+
+    /* Magnitude limit, one more for negative numbers. */
+    limit = negative ? 0x80000000UL : 0x7FFFFFFFUL;
+
+    for (; *str; str++) {
+        digit = strDigit(*str, base);
+        if (digit == base) return STR_ERR_SYNTAX;
+        if (result > (limit - digit) / base) return STR_ERR_OVERFLOW;
+        result = result * base + digit;
+    }
+
+    *value = negative ? -(int32_t)(result - 1) - 1 : (int32_t)result;
+    return STR_OK;
+}
+
+uint8_t strParseInt16(const uint8_t *str, int16_t *value) {
+    int32_t result;
+    uint8_t status = strParseInt32(str, &result);
+
+    if (status != STR_OK) return status;
+    if ((result < INT16_MIN) || (result > INT16_MAX)) return STR_ERR_OVERFLOW;
+    *value = result;
+    return STR_OK;
+}
+
+uint8_t strParseFixed(const uint8_t *str, uint8_t decimals, int32_t *value) {
+    uint8_t negative = 0;
+    uint8_t seenPoint = 0;
+    uint8_t seenDigit = 0;
+    uint8_t digit;
+    uint32_t result = 0;
+    uint32_t limit;
+
+    if (*str == '-') {
+        negative = 1;
+        str++;
+    } else if (*str == '+') {
+        str++;
+    }
+    limit = negative ? 0x80000000UL : 0x7FFFFFFFUL;
+
+    for (; *str; str++) {
+        if ((*str == '.') && !seenPoint) {
+            seenPoint = 1;
+            continue;
+        }
+        digit = strDigit(*str, 10);
+        if (digit == 10) return STR_ERR_SYNTAX;
+        seenDigit = 1;
+        if (seenPoint) {
+            /* Fraction digits beyond the precision are dropped. */
+            if (decimals == 0) continue;
+            decimals--;
+        }
+        if (result > (limit - digit) / 10) return STR_ERR_OVERFLOW;
+        result = result * 10 + digit;
+    }
+    if (!seenDigit) return STR_ERR_SYNTAX;
+
+    /* Scale up for fraction digits that were not given. */
+    while (decimals--) {
+        if (result > limit / 10) return STR_ERR_OVERFLOW;
+        result *= 10;
+    }
+
+    *value = negative ? -(int32_t)(result - 1) - 1 : (int32_t)result;
+    return STR_OK;
+}
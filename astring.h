@@ -0,0 +1,36 @@
+#ifndef ASTRING_H_
+#define ASTRING_H_
+
+/* Status codes of the parse functions. */
+#define STR_OK              0
+#define STR_ERR_SYNTAX      1   /* Not a number. */
+#define STR_ERR_OVERFLOW    2   /* Number does not fit the requested type. */
+
+/* A token of a tokenized string.
+ * str points into the tokenized buffer and is null terminated. */
+typedef struct strToken_ {
+    uint8_t *str;
+    uint8_t len;
+} strToken;
+
+/* Splits a null terminated string into space separated tokens, in place.
+ * The separators are overwritten with null terminators and at most
+ * maxTokens tokens are stored.
+ * Returns the number of tokens found, which exceeds maxTokens if there
+ * were too many. */
+uint8_t strTokenize(uint8_t *str, strToken *tokens, uint8_t maxTokens);
+
+/* Parses a decimal or 0x prefixed hexadecimal integer with optional sign.
+ * Returns STR_OK and stores the value on success. */
+uint8_t strParseInt32(const uint8_t *str, int32_t *value);
+
+/* As strParseInt32() but for values fitting an int16_t. */
+uint8_t strParseInt16(const uint8_t *str, int16_t *value);
+
+/* Parses a decimal number such as "-1.25" into a fixed-point integer with
+ * the given number of decimals, "-1.25" with 3 decimals gives -1250.
+ * Digits beyond the given number of decimals are truncated.
+ * Returns STR_OK and stores the value on success. */
+uint8_t strParseFixed(const uint8_t *str, uint8_t decimals, int32_t *value);
+
+#endif /* ASTRING_H_ */
@@ -0,0 +1,328 @@
+/* Firmware benchmarks under simavr.
+ *
+ * Runs main.elf on a simulated ATmega324PA, talks to it through UART0
+ * (the FT312 link) the way the app does and reports:
+ *   - latency from the last byte of a speed setpoint to the OCR0A write,
+ *   - latency from the last byte of a get to the first byte of the reply,
+ *   - sustained get commands per second at several baud rates, with the
+ *     number of commands that went unanswered,
+ * in ASCII and in binary (SLIP) mode.
+ *
+ * Bytes are fed at line rate, one character time (10 bits) apart. All
+ * latencies are counted from the moment the last byte is handed to the
+ * simulated UART and include the one character time the simulator takes
+ * to receive it, which is reported as char_cycles.
+ *
+ * Output is one JSON object per line on stdout, for example
+ *   {"bench":"latency_set","mode":"ascii","baud":57600,"cycles":2113,"char_cycles":3472}
+ * Progress and errors go to stderr. Exits nonzero if the firmware crashes
+ * or a benchmark gets no answer at all.
+ *
+ * Usage: bench [-m mcu] main.elf */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "avr_uart.h"
+#include "avr_timer.h"
+
+#define BENCH_F_CPU         20000000UL
+#define BENCH_BAUD          57600
+#define BENCH_COMMANDS      200     /* Commands per throughput run. */
+#define BENCH_TIMEOUT       (BENCH_F_CPU / 10)  /* 100 ms of simulated time. */
+#define BENCH_QUEUE_SIZE    4096
+
+/* Mirrors of firmware constants, see proto.h and prop.h. */
+#define PROTO_END           0xC0
+#define PROTO_ESC           0xDB
+#define PROTO_ESC_END       0xDC
+#define PROTO_ESC_ESC       0xDD
+#define PROTO_OP_SET        0x00
+#define PROTO_OP_GET        0x40
+#define PROP_M1SPEED        1
+#define PROP_LED1           5
+#define PROP_UART0MODE      11
+#define PROP_UART0BAUD      17
+
+#define MODE_ASCII          0
+#define MODE_BINARY         1
+
+static avr_t *avr;
+static avr_irq_t *uartIn;
+
+/* Bytes waiting to be fed to the firmware. */
+static uint8_t queue[BENCH_QUEUE_SIZE];
+static unsigned queueHead, queueTail;
+static avr_cycle_count_t nextByte;
+static avr_cycle_count_t charCycles;
+static avr_cycle_count_t lastFed;
+
+/* What the firmware did. */
+static unsigned replies;            /* Reply lines or frames seen. */
+static avr_cycle_count_t firstReply;
+static avr_cycle_count_t lastReply;
+static avr_cycle_count_t pwmWrite;
+
+static uint8_t mode = MODE_ASCII;
+static int failed;
+
+static void uartOutHook(struct avr_irq_t *irq, uint32_t value, void *param) {
+    if (!firstReply) firstReply = avr->cycle;
+    lastReply = avr->cycle;
+    if (mode == MODE_ASCII ? (value == '\n') : (value == PROTO_END)) replies++;
+}
+
+static void pwmHook(struct avr_irq_t *irq, uint32_t value, void *param) {
+    if (!pwmWrite) pwmWrite = avr->cycle;
+}
+
+static void setBaud(unsigned long baud) {
+    /* 1 start, 8 data and 1 stop bit. */
+    charCycles = BENCH_F_CPU * 10 / baud;
+}
+
+static void send(const uint8_t *data, unsigned len) {
+    while (len--) {
+        queue[queueHead++ % BENCH_QUEUE_SIZE] = *data++;
+    }
+}
+
+static void sendString(const char *s) {
+    send((const uint8_t *)s, strlen(s));
+}
+
+static uint8_t crc8(uint8_t crc, uint8_t data) {
+    /* Same as _crc8_ccitt_update() of avr-libc. */
+    uint8_t i;
+
+    crc ^= data;
+    for (i = 0; i < 8; i++) {
+        crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+static void sendEscaped(uint8_t data) {
+    uint8_t esc[2] = { PROTO_ESC, data == PROTO_END ? PROTO_ESC_END : PROTO_ESC_ESC };
+
+    if ((data == PROTO_END) || (data == PROTO_ESC)) {
+        send(esc, 2);
+    } else {
+        send(&data, 1);
+    }
+}
+
+static void sendFrame(uint8_t header, const uint8_t *payload, unsigned len) {
+    uint8_t crc = crc8(0, header);
+    uint8_t end = PROTO_END;
+
+    sendEscaped(header);
+    while (len--) {
+        crc = crc8(crc, *payload);
+        sendEscaped(*payload++);
+    }
+    sendEscaped(crc);
+    send(&end, 1);
+}
+
+static void step(void) {
+    /* Runs one instruction, feeding the next queued byte when due. */
+    if ((queueTail != queueHead) && (avr->cycle >= nextByte)) {
+        avr_raise_irq(uartIn, queue[queueTail++ % BENCH_QUEUE_SIZE]);
+        lastFed = avr->cycle;
+        nextByte = avr->cycle + charCycles;
+    }
+    int state = avr_run(avr);
+    if ((state == cpu_Done) || (state == cpu_Crashed)) {
+        fprintf(stderr, "bench: firmware stopped, state %d\n", state);
+        exit(1);
+    }
+}
+
+static void runFor(avr_cycle_count_t cycles) {
+    avr_cycle_count_t end = avr->cycle + cycles;
+    while (avr->cycle < end) step();
+}
+
+static void drain(void) {
+    /* Feeds everything queued and lets the firmware settle. */
+    while (queueTail != queueHead) step();
+    runFor(BENCH_TIMEOUT / 10);
+}
+
+static int waitFor(avr_cycle_count_t *event) {
+    /* Runs until the event has happened. Returns 0 on timeout. */
+    avr_cycle_count_t end = avr->cycle + BENCH_TIMEOUT;
+
+    while ((queueTail != queueHead) || (!*event && (avr->cycle < end))) step();
+    return *event != 0;
+}
+
+static void report(const char *bench, unsigned long baud, const char *key, long long value) {
+    printf("{\"bench\":\"%s\",\"mode\":\"%s\",\"baud\":%lu,\"%s\":%lld,\"char_cycles\":%llu}\n",
+           bench, mode == MODE_ASCII ? "ascii" : "binary", baud, key, value,
+           (unsigned long long)charCycles);
+}
+
+static void reportFailure(const char *bench, unsigned long baud) {
+    fprintf(stderr, "bench: %s timed out\n", bench);
+    report(bench, baud, "cycles", -1);
+    failed = 1;
+}
+
+static void sendSetSpeed(int8_t speed) {
+    char line[32];
+
+    if (mode == MODE_ASCII) {
+        snprintf(line, sizeof(line), "set m1speed %d\r", speed);
+        sendString(line);
+    } else {
+        uint8_t payload = (uint8_t)speed;
+        sendFrame(PROTO_OP_SET | PROP_M1SPEED, &payload, 1);
+    }
+}
+
+static void sendGet(void) {
+    if (mode == MODE_ASCII) {
+        sendString("get led1\r");
+    } else {
+        sendFrame(PROTO_OP_GET | PROP_LED1, 0, 0);
+    }
+}
+
+static void benchLatency(unsigned long baud, int8_t speed) {
+    /* Setpoint to PWM register. */
+    pwmWrite = 0;
+    sendSetSpeed(speed);
+    if (waitFor(&pwmWrite)) {
+        report("latency_set", baud, "cycles", (long long)(pwmWrite - lastFed));
+    } else {
+        reportFailure("latency_set", baud);
+    }
+    drain();
+
+    /* Request to first byte of the reply. */
+    firstReply = 0;
+    sendGet();
+    if (waitFor(&firstReply)) {
+        report("latency_reply", baud, "cycles", (long long)(firstReply - lastFed));
+    } else {
+        reportFailure("latency_reply", baud);
+    }
+    drain();
+}
+
+static void benchThroughput(unsigned long baud) {
+    avr_cycle_count_t start;
+    unsigned i;
+
+    replies = 0;
+    start = avr->cycle;
+    for (i = 0; i < BENCH_COMMANDS; i++) sendGet();
+    drain();
+
+    /* Up to the end of the last reply, not including the settle time. */
+    double seconds = (double)(lastReply + charCycles - start) / BENCH_F_CPU;
+    report("throughput", baud, "commands_per_s", replies ? (long long)(replies / seconds) : 0);
+    report("throughput", baud, "lost", BENCH_COMMANDS - replies);
+}
+
+static void switchBaud(unsigned long baud) {
+    /* The firmware switches after the reply, which for an ASCII set is
+     * nothing, and falls back unless a valid command follows. */
+    char line[32];
+
+    if (mode == MODE_ASCII) {
+        snprintf(line, sizeof(line), "set uart0baud %lu\r", baud / 100);
+        sendString(line);
+    } else {
+        uint16_t value = baud / 100;
+        uint8_t payload[2] = { value & 0xFF, value >> 8 };
+        sendFrame(PROTO_OP_SET | PROP_UART0BAUD, payload, 2);
+    }
+    drain();
+    setBaud(baud);
+}
+
+static void switchMode(uint8_t newMode) {
+    if (mode == MODE_ASCII) {
+        sendString(newMode == MODE_BINARY ? "set uart0mode 1\r" : "set uart0mode 0\r");
+    } else {
+        uint8_t payload = newMode;
+        sendFrame(PROTO_OP_SET | PROP_UART0MODE, &payload, 1);
+    }
+    drain();
+    mode = newMode;
+}
+
+static void benchMode(uint8_t newMode) {
+    static const unsigned long rates[] = { 57600, 250000, 500000, 1250000 };
+    unsigned i;
+
+    switchMode(newMode);
+    for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        if (rates[i] != BENCH_BAUD) switchBaud(rates[i]);
+        benchLatency(rates[i], (i & 1) ? -50 : 50);
+        benchThroughput(rates[i]);
+    }
+    switchBaud(BENCH_BAUD);
+}
+
+int main(int argc, char *argv[]) {
+    elf_firmware_t firmware;
+    const char *mcu = "atmega324pa";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:")) != -1) {
+        if (opt == 'm') mcu = optarg;
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-m mcu] main.elf\n", argv[0]);
+        return 2;
+    }
+
+    memset(&firmware, 0, sizeof(firmware));
+    if (elf_read_firmware(argv[optind], &firmware) != 0) {
+        fprintf(stderr, "bench: can not read %s\n", argv[optind]);
+        return 2;
+    }
+    /* Older simavr releases only know the ATmega324P, same peripherals. */
+    avr = avr_make_mcu_by_name(mcu);
+    if (!avr && !strcmp(mcu, "atmega324pa")) avr = avr_make_mcu_by_name("atmega324p");
+    if (!avr) {
+        fprintf(stderr, "bench: unknown mcu %s\n", mcu);
+        return 2;
+    }
+    avr_init(avr);
+    firmware.frequency = BENCH_F_CPU;
+    avr_load_firmware(avr, &firmware);
+
+    /* Keep the UART off the simulator's stdout. */
+    uint32_t flags = 0;
+    avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+    flags &= ~AVR_UART_FLAG_STDIO;
+    avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+
+    uartIn = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+                            uartOutHook, NULL);
+    /* M1 duty cycle, OCR0A. */
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_TIMER_GETIRQ('0'), TIMER_IRQ_OUT_PWM0),
+                            pwmHook, NULL);
+
+    setBaud(BENCH_BAUD);
+    /* Let the firmware boot and print its banner. */
+    runFor(BENCH_TIMEOUT);
+
+    benchMode(MODE_ASCII);
+    benchMode(MODE_BINARY);
+    switchMode(MODE_ASCII);
+
+    return failed;
+}
@@ -1,213 +1,421 @@
-#include <stdio.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include "config.h"
 #include "astring.h"
-#include "cmd.h"
-#include "motor.h"
-#include "adc.h"
 #include "uart.h"
+#include "cmd.h"
+#include "prop.h"
+#include "fmt.h"
+#include "proto.h"
+#include "tick.h"
+#include "prof.h"
+
+#define CMD_SET 1
+#define CMD_GET 2
+#define CMD_DRIVE 3
+
+/* Longest property name printed by cmdEvent(). */
+#define CMD_EVENT_NAME_SIZE 12
+
+/* Command names live in flash.
+ * The lookup table must be kept sorted by name, see cmdLookup(). */
+static const char cmdNameDrive[] PROGMEM = "drive";
+static const char cmdNameGet[] PROGMEM = "get";
+static const char cmdNameSet[] PROGMEM = "set";
+
+static const cmdName cmdList[] PROGMEM = {
+    { cmdNameDrive, CMD_DRIVE },
+    { cmdNameGet, CMD_GET },
+    { cmdNameSet, CMD_SET },
+};
 
-static char *cmdList[] = {
-    "set",
-    "get",
-    '\0'
+#define CMD_LIST_LEN (sizeof(cmdList) / sizeof(cmdList[0]))
+
+/* Reports print more than a single value. They are read with get like
+ * properties, and cleared by setting them to zero.
+ * The table must be kept sorted by name, see cmdLookup(). */
+#define CMD_REPORT_PROF 1
+
+static const char cmdNameProf[] PROGMEM = "prof";
+
+static const cmdName cmdReportList[] PROGMEM = {
+    { cmdNameProf, CMD_REPORT_PROF },
 };
 
-static char *cmdPropList[] = {
-    "m1speed",
-    "m2speed",
-    "m1disable",
-    "m2disable",
-    "led1",
-    "led2",
-    "led3",
-    "led4",
-    "m1current",
-    "m2current",
-    '\0'
+#define CMD_REPORT_LEN (sizeof(cmdReportList) / sizeof(cmdReportList[0]))
+
+cmdSession cmdSessions[CMD_SESSION_COUNT] = {
+    /* UART0, starts out in ASCII mode until the app asks for binary. */
+    { UART_PORT0, PROTO_MODE_ASCII, 0, SERIAL_BAUDRATE / 100, 0, 0, 0 },
+    /* UART1, echo for the benefit of terminal users. */
+    { UART_PORT1, PROTO_MODE_ASCII, 1, SERIAL_BAUDRATE / 100, 0, 0, 0 },
 };
 
-void cmdParser(uint8_t *bufPtr) {
-    uint8_t *strPtr = bufPtr;
-
-    uint8_t len = getEndOfPart(strPtr);
-    char result = compareStrs(strPtr, cmdList, len, 1);
-    strPtr += len;
-    switch(result) {
-        case 1: cmdSet(strPtr); break;
-        case 2: cmdGet(strPtr); break;
-        default: uart1_puts_P("Invalid command\r\n");
-    }
-}
-
-void cmdSet(uint8_t *bufPtr) {
-    uint8_t *strPtr = bufPtr;
-    int8_t value;
-
-    /* Make sure another parameter is coming. */
-    if(strPtr[0] != 0x20) { uart1_puts_P("Error: Set requires at least 2 parameters.\r\n"); return; }
-    strPtr++; /* Jump across the space. */
-    
-    /* Get the next parameter / property. */
-    uint8_t len = getEndOfPart(strPtr);
-    uint8_t result = (uint8_t)compareStrs(strPtr, cmdPropList, len, 1);
-    //strPtr++; /* Jump across the space to the value. */
-    strPtr += len;
-    if(strPtr[0] != 0x20) { uart1_puts_P("Error: Set requires at least 2 parameters.\r\n"); return; }
-    strPtr++; /* Jump across the space. */
-
-    len = getEndOfPart(strPtr);
-    if(strPtr[0] == 0x2D) { /* ASCII 2D = - (dash). */
-        /* Let's handle negative values.
-         * This would be better to handle in astring.c. */
-        strPtr++; /* Jump the pesky dash. */
-        value = getInteger(strPtr, len-1);
-        if(value == -1) { uart1_puts_P("Error: Expected ninteger.\r\n"); return;}
-        value = -value;
+static void cmdPutLine(cmdSession *session, char *buf, uint8_t len) {
+    /* Terminates a formatted number and sends it as one block. */
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    uart_write(session->port, (const unsigned char *)buf, len);
+}
+
+static uint8_t cmdFormat(char *buf, uint8_t type, int16_t value) {
+    /* Formats a property value the way its PROP_TYPE_* asks for.
+     * Returns the length, at most FMT_SIZE. */
+    if (type & PROP_TYPE_FIXED(0)) {
+        return fmtFixed(buf, value, PROP_TYPE_DECIMALS(type));
+    } else if (type == PROP_TYPE_INT) {
+        return fmtDec(buf, value);
+    } else if (type == PROP_TYPE_UINT) {
+        return fmtUDec(buf, value);
+    }
+    return fmtHex(buf, value);
+}
+
+static void cmdApplyMode(cmdSession *session) {
+    uint8_t mode;
+
+    if (session->mode == PROTO_MODE_BINARY) {
+        mode = UART_MODE_SLIP;
     } else {
-        value = getInteger(strPtr, len);
-        if(value == -1) { uart1_puts_P("Error: Expected integer.\r\n"); return;}
-    }
-
-    setProperty(result, value);
-}
-
-void cmdGet(uint8_t *bufPtr) {
-    /* Command to fetch values of various properties.
-     * Implement actual procedures to get values.*/
-    uint8_t *strPtr = bufPtr;
-    
-    /* Make sure another parameter is coming. */
-    if(strPtr[0] != 0x20) { uart1_puts_P("Error: Get requires a property to fetch.\r\n"); return; }
-    strPtr++; /* Jump space. */
-    
-    uint8_t len = getEndOfPart(strPtr);
-    uint8_t result = (uint8_t)compareStrs(strPtr, cmdPropList, len, 1);
-    
-    switch(result) {
-        case 1: 
-            /* m1speed */
-#if DISABLE_PWM
-            uartPutHex(M1_PWM_DC);
-#else
-            uartPutHex(M1_IN1_DC | M1_IN2_DC);
-#endif /* DISABLE_PWM */
-            break;
-        case 2: 
-            /* m2speed */
-#if DISABLE_PWM
-            uartPutHex(M2_PWM_DC);
-#else
-            uartPutHex(M2_IN1_DC | M2_IN2_DC);
-#endif /* DISABLE_PWM */
-            break;
-        case 3: 
-            /* m1disable */
-#if DISABLE_PWM
-            uart1_puts_P("Error: Not implemented\r\n");
-#else
-            uartPutHex(0x1&(M1_PIN>>PA1));
-#endif /* DISABLE_PWM */
-            break;
-        case 4: 
-            /* m2disable */
-#if DISABLE_PWM
-            uart1_puts_P("Error: Not implemented\r\n");
-#else
-            uartPutHex(0x1&(M2_PIN>>PA5));
-#endif /* DISABLE_PWM */
-            break;
-        case 5:
-            /* led1 */
-            uart1_puts_P("Error: Not Implemented.\r\n"); /* TODO */
-            break;
-        case 6: 
-            /* led2 */
-            uart1_puts_P("Error: Not Implemented.\r\n"); /* TODO */
-            break;
-        case 7: 
-            /* led3 */
-            uart1_puts_P("Error: Not Implemented.\r\n"); /* TODO */
-            break;
-        case 8: 
-            /* led4 */
-            uart1_puts_P("Error: Not Implemented.\r\n"); /* TODO */
-            break;
-        case 9:
-            /* m1current */
-            uartPutHex(lastAdcValM1);
-            break;
-        case 10:
-            /* m2current */
-            uartPutHex(lastAdcValM2);
-            break;
-        default:
-            /* Invalid command. */
-            uart1_puts_P("Error: Invalid property.\r\n");
+        mode = session->echo ? (UART_MODE_LINE | UART_MODE_ECHO) : UART_MODE_LINE;
     }
+    uart_setmode(session->port, mode);
 }
 
-void setProperty(uint8_t propIndex, int8_t value) {
-    switch(propIndex) {
-        case 1: 
-            /* m1speed */
-            setSpeedM1(value);
-            break;
-        case 2: 
-            /* m2speed */
-            setSpeedM2(value);
-            break;
-        case 3: 
-            /* m1disable */
-            setDisableM1(value);
-            break;
-        case 4: 
-            /* m2disable */
-            setDisableM2(value);
+void cmdSetMode(cmdSession *session, uint8_t mode) {
+    session->mode = mode;
+    cmdApplyMode(session);
+}
+
+void cmdSetEcho(cmdSession *session, uint8_t echo) {
+    session->echo = echo;
+    cmdApplyMode(session);
+}
+
+static unsigned int cmdBaudSelect(uint16_t baud) {
+    return uart_baudselect(baud * 100UL);
+}
+
+uint8_t cmdSetBaud(cmdSession *session, uint16_t baud) {
+    if (cmdBaudSelect(baud) == UART_BAUD_INVALID) return PROP_ERR_RANGE;
+    session->baudNew = baud;
+    return PROP_OK;
+}
+
+static void cmdPollBaud(cmdSession *session) {
+    /* Switching while the reply is still going out would garble it, and
+     * the host only moves to the new rate after reading the reply. */
+    if (session->baudNew && uart_txidle(session->port)) {
+        /* Drops the lines received so far, only a line received at the
+         * new rate confirms it. */
+        uart_setbaud(session->port, cmdBaudSelect(session->baudNew));
+        if (!session->baudOld) session->baudOld = session->baud;
+        session->baud = session->baudNew;
+        session->baudNew = 0;
+        session->baudDeadline = tickNow() + SERIAL_FALLBACK_MS;
+    }
+    /* Nothing intelligible at the new rate, the host did not follow. */
+    if (session->baudOld && tickElapsed(session->baudDeadline)) {
+        uart_setbaud(session->port, cmdBaudSelect(session->baudOld));
+        session->baud = session->baudOld;
+        session->baudOld = 0;
+    }
+}
+
+uint8_t cmdPoll(cmdSession *session) {
+    uint8_t *line;
+    uint8_t len;
+    uint8_t valid;
+
+    /* A reply cuts a block short, see protoSendBlock(). */
+    protoPollBlock(session);
+    cmdPollBaud(session);
+    if (!(line = uart_getline(session->port, &len))) return 0;
+    PROF_BEGIN(PROF_CMD);
+    if (session->mode == PROTO_MODE_BINARY) {
+        valid = protoParser(session, line, len);
+    } else {
+        valid = cmdParser(session, line);
+    }
+    PROF_END(PROF_CMD);
+    uart_releaseline(session->port);
+    /* A valid command confirms the current baud rate. */
+    if (valid) session->baudOld = 0;
+    return 1;
+}
+
+uint8_t cmdLookup(const uint8_t *str, uint8_t len, const cmdName *table, uint8_t count) {
+    /* Resolves a name, or a unique prefix of one, through a binary search
+     * of a sorted table in flash.
+     * Names sharing a prefix end up next to each other in the table, with
+     * an exact match first, so only the neighbour has to be checked for
+     * ambiguity. */
+    uint8_t low = 0;
+    uint8_t high = count;
+    PGM_P name;
+
+    if (len == 0) return CMD_LOOKUP_NONE;
+
+    /* Find the first entry not less than the given prefix. */
+    while (low < high) {
+        uint8_t mid = (low + high) >> 1;
+        name = (PGM_P)pgm_read_word(&table[mid].name);
+        if (strncmp_P((const char *)str, name, len) > 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == count) return CMD_LOOKUP_NONE;
+
+    name = (PGM_P)pgm_read_word(&table[low].name);
+    if (strncmp_P((const char *)str, name, len) != 0) return CMD_LOOKUP_NONE;
+
+    /* An exact match wins even if longer names share it as a prefix. */
+    if ((pgm_read_byte(name + len) != '\0') && (low + 1 < count)) {
+        name = (PGM_P)pgm_read_word(&table[low + 1].name);
+        if (strncmp_P((const char *)str, name, len) == 0) return CMD_LOOKUP_AMBIGUOUS;
+    }
+
+    return pgm_read_byte(&table[low].id);
+}
+
+uint8_t cmdParser(cmdSession *session, uint8_t *bufPtr) {
+    strToken argv[CMD_MAX_ARGS];
+    uint8_t argc = strTokenize(bufPtr, argv, CMD_MAX_ARGS);
+    uint8_t command;
+
+    if (argc == 0) { cmdPuts_P(session, "Invalid command\r\n"); return 0; }
+
+    /* Even a rejected line is valid traffic if it starts with a command. */
+    command = cmdLookup(argv[0].str, argv[0].len, cmdList, CMD_LIST_LEN);
+    if ((command == CMD_LOOKUP_NONE) || (command == CMD_LOOKUP_AMBIGUOUS)) command = 0;
+
+    if (argc > CMD_MAX_ARGS) { cmdPuts_P(session, "Error: Too many parameters.\r\n"); return command; }
+
+    switch(command) {
+        case CMD_SET: cmdSet(session, argc, argv); break;
+        case CMD_GET: cmdGet(session, argc, argv); break;
+        case CMD_DRIVE: cmdDrive(session, argc, argv); break;
+        default: cmdPuts_P(session, "Invalid command\r\n");
+    }
+    return command;
+}
+
+#if PROF_ENABLE
+static uint8_t cmdReportProf(cmdSession *session) {
+    /* One line per probe, all times in units of 8 cycles:
+     * name count min max mean hist0 .. hist7 */
+    char line[8 + (1 + PROF_BUCKETS + 4) * (FMT_SIZE + 1) + 2];
+    profStat stat;
+    uint8_t probe;
+    uint8_t i;
+    uint8_t len;
+    PGM_P name;
+
+    cmdPuts_P(session, "probe count min max mean hist, in 8 cycle units\r\n");
+    for (probe = 0; probe < PROF_COUNT; probe++) {
+        profRead(probe, &stat);
+        name = profName(probe);
+        len = 0;
+        while ((line[len] = pgm_read_byte(name++))) len++;
+        line[len++] = ' ';
+        len += fmtUDec(&line[len], stat.count);
+        line[len++] = ' ';
+        len += fmtUDec(&line[len], stat.min);
+        line[len++] = ' ';
+        len += fmtUDec(&line[len], stat.max);
+        line[len++] = ' ';
+        len += fmtUDec(&line[len], stat.count ? stat.sum / stat.count : 0);
+        for (i = 0; i < PROF_BUCKETS; i++) {
+            line[len++] = ' ';
+            len += fmtUDec(&line[len], stat.hist[i]);
+        }
+        line[len++] = '\r';
+        line[len++] = '\n';
+        uart_write(session->port, (const unsigned char *)line, len);
+    }
+    return PROP_OK;
+}
+#endif /* PROF_ENABLE */
+
+static uint8_t cmdReport(cmdSession *session, uint8_t report) {
+    /* Prints a report. Returns a PROP_* status. */
+    uint8_t status = PROP_ERR_NOTIMPL;
+    /* A report does not fit the transmit buffer, wait for room rather
+     * than lose the rest of it. */
+    uint8_t policy = uart_settxpolicy(session->port, UART_TX_BLOCK);
+
+    switch(report) {
+#if PROF_ENABLE
+        case CMD_REPORT_PROF:
+            status = cmdReportProf(session);
             break;
-        case 5:
-            /* led1 */
-            uart1_puts_P("Error: Not Implemented.\r\n"); /* TODO */
+#endif /* PROF_ENABLE */
+    }
+    uart_settxpolicy(session->port, policy);
+    return status;
+}
+
+static uint8_t cmdClearReport(uint8_t report, const uint8_t *value) {
+    /* Clears the data behind a report, only zero is accepted as value. */
+    int16_t zero;
+
+    if ((strParseInt16(value, &zero) != STR_OK) || (zero != 0)) return PROP_ERR_RANGE;
+    switch(report) {
+#if PROF_ENABLE
+        case CMD_REPORT_PROF:
+            profReset();
+            return PROP_OK;
+#endif /* PROF_ENABLE */
+    }
+    return PROP_ERR_NOTIMPL;
+}
+
+static uint8_t cmdLookupName(const strToken *name, uint8_t *prop, uint8_t *report) {
+    /* Resolves the name of a property or of a report, both tables are
+     * searched so that a prefix of names in either is ambiguous. On
+     * success one of prop and report is set, the other is none. Returns
+     * a PROP_* status. */
+    *prop = propLookup(name->str, name->len);
+    *report = cmdLookup(name->str, name->len, cmdReportList, CMD_REPORT_LEN);
+    if((*prop == PROP_LOOKUP_AMBIGUOUS) || (*report == CMD_LOOKUP_AMBIGUOUS)) return PROP_ERR_AMBIGUOUS;
+    if(*prop == PROP_LOOKUP_NONE) return (*report == CMD_LOOKUP_NONE) ? PROP_ERR_PROPERTY : PROP_OK;
+    return (*report == CMD_LOOKUP_NONE) ? PROP_OK : PROP_ERR_AMBIGUOUS;
+}
+
+void cmdSet(cmdSession *session, uint8_t argc, strToken *argv) {
+    int32_t value;
+    uint8_t status;
+    uint8_t result;
+    uint8_t report;
+
+    if(argc != 3) { cmdPuts_P(session, "Error: Set requires 2 parameters.\r\n"); return; }
+
+    status = cmdLookupName(&argv[1], &result, &report);
+    if(status != PROP_OK) { cmdPrintError(session, status); return; }
+    if(report != CMD_LOOKUP_NONE) { cmdPrintError(session, cmdClearReport(report, argv[2].str)); return; }
+
+    uint8_t type = propType(result);
+    if (type & PROP_TYPE_FIXED(0)) {
+        status = strParseFixed(argv[2].str, PROP_TYPE_DECIMALS(type), &value);
+    } else {
+        status = strParseInt32(argv[2].str, &value);
+    }
+    if(status == STR_ERR_SYNTAX) { cmdPuts_P(session, "Error: Expected integer.\r\n"); return; }
+    if((status == STR_ERR_OVERFLOW) ||
+       ((type == PROP_TYPE_UINT) ? ((value < 0) || (value > UINT16_MAX))
+                                 : ((value < INT16_MIN) || (value > INT16_MAX)))) {
+        cmdPrintError(session, PROP_ERR_RANGE);
+        return;
+    }
+
+    cmdPrintError(session, propSet(result, value));
+}
+
+void cmdGet(cmdSession *session, uint8_t argc, strToken *argv) {
+    /* Command to fetch values of various properties. */
+    int16_t value;
+    uint8_t status;
+    uint8_t result;
+    uint8_t report;
+
+    if(argc != 2) { cmdPuts_P(session, "Error: Get requires a property to fetch.\r\n"); return; }
+
+    status = cmdLookupName(&argv[1], &result, &report);
+    if(status != PROP_OK) { cmdPrintError(session, status); return; }
+    if(report != CMD_LOOKUP_NONE) { cmdPrintError(session, cmdReport(session, report)); return; }
+
+    status = propGet(result, &value);
+    if (status != PROP_OK) {
+        cmdPrintError(session, status);
+    } else {
+        char buf[FMT_SIZE + 2];
+        cmdPutLine(session, buf, cmdFormat(buf, propType(result), value));
+    }
+}
+
+void cmdDrive(cmdSession *session, uint8_t argc, strToken *argv) {
+    /* Sets both speeds at once, "drive m1speed m2speed", see PROP_DRIVE. */
+    int16_t m1;
+    int16_t m2;
+
+    if(argc != 3) { cmdPuts_P(session, "Error: Drive requires 2 parameters.\r\n"); return; }
+
+    if((strParseInt16(argv[1].str, &m1) != STR_OK) || (strParseInt16(argv[2].str, &m2) != STR_OK)) {
+        cmdPuts_P(session, "Error: Expected integer.\r\n");
+        return;
+    }
+    if((m1 < INT8_MIN) || (m1 > INT8_MAX) || (m2 < INT8_MIN) || (m2 > INT8_MAX)) {
+        cmdPrintError(session, PROP_ERR_RANGE);
+        return;
+    }
+
+    cmdPrintError(session, propSet(PROP_DRIVE, (uint8_t)m1 | ((uint16_t)(uint8_t)m2 << 8)));
+}
+
+void cmdEvent(uint8_t id) {
+    int16_t value;
+    uint8_t i;
+
+    if (propGet(id, &value) != PROP_OK) return;
+    for (i = 0; i < CMD_SESSION_COUNT; i++) {
+        cmdSession *session = &cmdSessions[i];
+        if (session->mode == PROTO_MODE_BINARY) {
+            uint8_t payload[2] = { (uint8_t)value, (uint8_t)(value >> 8) };
+            protoSendFrame(session, PROTO_OP_ACK | id, payload, 2);
+        } else {
+            /* "! name value", the mark sets it apart from replies. */
+            char line[2 + CMD_EVENT_NAME_SIZE + 1 + FMT_SIZE + 2];
+            PGM_P name = propGetName(id);
+            uint8_t len = 2;
+            line[0] = '!';
+            line[1] = ' ';
+            while ((len < 2 + CMD_EVENT_NAME_SIZE) && (line[len] = pgm_read_byte(name++))) len++;
+            line[len++] = ' ';
+            cmdPutLine(session, line, len + cmdFormat(&line[len], propType(id), value));
+        }
+    }
+}
+
+void cmdPrintError(cmdSession *session, uint8_t status) {
+    /* Prints the console message matching a property access status. */
+    switch(status) {
+        case PROP_OK:
             break;
-        case 6: 
-            /* led2 */
-            uart1_puts_P("Error: Not Implemented.\r\n"); /* TODO */
+        case PROP_ERR_NOTIMPL:
+            cmdPuts_P(session, "Error: Not Implemented.\r\n");
             break;
-        case 7: 
-            /* led3 */
-            uart1_puts_P("Error: Not Implemented.\r\n"); /* TODO */
+        case PROP_ERR_ACCESS:
+            cmdPuts_P(session, "Error: Non-valid Action.\r\n");
             break;
-        case 8: 
-            /* led4 */
-            uart1_puts_P("Error: Not Implemented.\r\n"); /* TODO */
+        case PROP_ERR_RANGE:
+            cmdPuts_P(session, "Error: Value out of range.\r\n");
             break;
-        case 9:
-            /* m1current */
-            uart1_puts_P("Error: Non-valid Action.\r\n");
+        case PROP_ERR_AMBIGUOUS:
+            cmdPuts_P(session, "Error: Ambiguous property.\r\n");
             break;
-        case 10:
-            /* m2current */
-            uart1_puts_P("Error: Non-valid Action.\r\n");
+        case PROP_ERR_FAULT:
+            cmdPuts_P(session, "Error: Fault still active.\r\n");
             break;
-        default: 
-            /* Invalid command. */
-            uart1_puts_P("Error: Invalid property.\r\n");
+        default:
+            /* Invalid property. */
+            cmdPuts_P(session, "Error: Invalid property.\r\n");
     }
 }
 
-void uartPutHex(uint16_t num) {
-    uint8_t buf[4];
-    sprintf(buf, "%X", num);
-    uart_puts_P("0x");
-    uart_puts(buf);
-    uart_puts_P("\r\n");
+void cmdPutHex(cmdSession *session, uint16_t num) {
+    char buf[FMT_SIZE + 2];
+    cmdPutLine(session, buf, fmtHex(buf, num));
+}
+
+void cmdPutDec(cmdSession *session, int16_t num) {
+    char buf[FMT_SIZE + 2];
+    cmdPutLine(session, buf, fmtDec(buf, num));
 }
 
-void uart1PutHex(uint16_t num) {
-    uint8_t buf[4];
-    sprintf(buf, "%X", num);
-    uart1_puts_P("0x");
-    uart1_puts(buf);
-    uart1_puts_P("\r\n");
+void cmdPutFixed(cmdSession *session, int16_t num, uint8_t decimals) {
+    char buf[FMT_SIZE + 2];
+    cmdPutLine(session, buf, fmtFixed(buf, num, decimals));
 }
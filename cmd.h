@@ -1,18 +1,90 @@
 #ifndef CMD_H_
 #define CMD_H_
 
-static char *cmdList[];
+/* Special results of cmdLookup(). */
+#define CMD_LOOKUP_NONE         0
+#define CMD_LOOKUP_AMBIGUOUS    0xFF
 
-static char *cmdPropList[];
+/* Entry of a name lookup table in flash. */
+typedef struct cmdName_ {
+    PGM_P name;
+    uint8_t id;
+} cmdName;
 
-void cmdParser(uint8_t *bufPtr);
+/* Looks up a name of the given length in a sorted table in flash.
+ * Any unique prefix of a name is accepted as well.
+ * Returns the id of the entry, CMD_LOOKUP_NONE or CMD_LOOKUP_AMBIGUOUS. */
+uint8_t cmdLookup(const uint8_t *str, uint8_t len, const cmdName *table, uint8_t count);
 
-void cmdSet(uint8_t *bufPtr);
+/* Maximum number of words in a command line. */
+#define CMD_MAX_ARGS 4
 
-void cmdGet(uint8_t *bufPtr);
+/* One command session per serial port.
+ * A session ties the line input of a port to its output, so every reply
+ * and error message goes back to the port the request came in on. */
+typedef struct cmdSession_ {
+    uint8_t port;   /* UART_PORT0 or UART_PORT1. */
+    uint8_t mode;   /* PROTO_MODE_ASCII or PROTO_MODE_BINARY. */
+    uint8_t echo;   /* Echo received characters in ASCII mode. */
+    /* Baud rates in units of 100 baud, see cmdSetBaud(). */
+    uint16_t baud;          /* Current rate. */
+    uint16_t baudNew;       /* Rate to switch to once the reply is out, 0 if none. */
+    uint16_t baudOld;       /* Rate to fall back to, 0 once the current one is confirmed. */
+    uint16_t baudDeadline;  /* tickNow() by which the current rate must be confirmed. */
+} cmdSession;
 
-void setProperty(uint8_t propIndex, int8_t value);
+/* Session numbers, same as the port numbers. */
+#define CMD_SESSION_UART0   UART_PORT0  /* FT312, the app link. */
+#define CMD_SESSION_UART1   UART_PORT1  /* FT230, the debug console. */
+#define CMD_SESSION_COUNT   UART_PORTS
 
-void uartPutHex(uint16_t num);
-void uart1PutHex(uint16_t num);
+extern cmdSession cmdSessions[CMD_SESSION_COUNT];
+
+/* Prints a string literal to the session. */
+#define cmdPuts_P(session, s)   uart_puts_P((session)->port, s)
+
+/* Switches the session to PROTO_MODE_ASCII or PROTO_MODE_BINARY and
+ * sets up the receive mode of its port accordingly. */
+void cmdSetMode(cmdSession *session, uint8_t mode);
+
+/* Turns echo of received characters on or off. Only takes effect in
+ * PROTO_MODE_ASCII, binary frames are never echoed. */
+void cmdSetEcho(cmdSession *session, uint8_t echo);
+
+/* Switches the port of the session to another baud rate, given in units
+ * of 100 baud. The switch happens once the reply to the current command
+ * has been sent. Unless a valid command arrives at the new rate within
+ * SERIAL_FALLBACK_MS the port goes back to the old one. Lines still
+ * queued from before a switch are dropped.
+ * Returns PROP_ERR_RANGE if the rate can not be met, see uart_baudselect(). */
+uint8_t cmdSetBaud(cmdSession *session, uint16_t baud);
+
+/* Executes the next complete line of the session, if any, with the parser
+ * of its protocol mode, and carries out pending baud rate changes.
+ * Returns nonzero if a line was handled. */
+uint8_t cmdPoll(cmdSession *session);
+
+/* Parses and executes a null terminated command line.
+ * The line is tokenized in place. Replies go to the given session.
+ * Returns nonzero if the line held a known command. */
+uint8_t cmdParser(cmdSession *session, uint8_t *bufPtr);
+
+void cmdSet(cmdSession *session, uint8_t argc, strToken *argv);
+
+void cmdGet(cmdSession *session, uint8_t argc, strToken *argv);
+
+void cmdDrive(cmdSession *session, uint8_t argc, strToken *argv);
+
+/* Reports the current value of a property to every session unasked,
+ * as "! name value" in ASCII mode and as a GET reply in binary mode. */
+void cmdEvent(uint8_t id);
+
+/* Prints a console error message for the given PROP_* status.
+ * Nothing is printed for PROP_OK. */
+void cmdPrintError(cmdSession *session, uint8_t status);
+
+/* Print a number followed by a line break to the session. */
+void cmdPutHex(cmdSession *session, uint16_t num);
+void cmdPutDec(cmdSession *session, int16_t num);
+void cmdPutFixed(cmdSession *session, int16_t num, uint8_t decimals);
 #endif /* CMD_H_ */
@@ -26,8 +26,85 @@
 
     /* UART */
     #define SERIAL_BAUDRATE 57600
-    #define UART_RX_BUFFER_SIZE 32
-    #define UART_TX_BUFFER_SIZE 64
+    /* After a baud rate change the host has this long to send a valid
+     * command at the new rate, otherwise the port falls back. */
+    #define SERIAL_FALLBACK_MS 2000
+    /* Received lines are at least double buffered, one is parsed while
+     * the next arrives. UART0 carries the app traffic and gets more line
+     * slots, the console is typed by hand and only needs the minimum.
+     * A line slot needs room for the longest command plus terminator. */
+    #define UART0_TX_BUFFER_SIZE 64
+    #define UART0_LINE_SLOTS 4
+    #define UART0_LINE_SIZE 32
+    #define UART1_TX_BUFFER_SIZE 64
+    #define UART1_LINE_SLOTS 2
+    #define UART1_LINE_SIZE 32
+
+    /* PWM frequency at first start, an entry of motorPwmTable in motor.c.
+     * 1 is 153 Hz. Changes are kept in EEPROM, see setPwmFreq(). */
+    #define MOTOR_PWM_DEFAULT   1
+
+    /* Speed ramps, see setAccel(). In speed units (1023 is full speed)
+     * per second, 0 leaves the speed unlimited. Can be changed at run
+     * time for each motor. */
+    #define MOTOR_ACCEL_DEFAULT 0
+    #define MOTOR_DECEL_DEFAULT 0
+
+    /* Torque mode, see torque.h. PI gains in thousandths, can be changed
+     * at run time. */
+    #define TORQUE_KP_DEFAULT   500
+    #define TORQUE_KI_DEFAULT   200
+
+    /* Current feedback filters, see adc.h. Blocks of 4^n samples are
+     * averaged, and the low-pass has a time constant of 2^n samples.
+     * Both can be changed at run time. */
+    #define ADC_OVERSAMPLE_LOG4 2
+    #define ADC_FILTER_SHIFT    3
+
+    /* Optional analog inputs, converted between the current feedback at
+     * a lower rate, every ADC_SLOW_WEIGHT passes, see adc.c.
+     * VBAT_ADC is the channel of a battery voltage divider, VBAT_NOMINAL
+     * its raw sample at the voltage the speeds are meant for. The duty
+     * is scaled to hold the motor voltage as the battery sags, see
+     * setSupply(). TEMP_ADC is the channel of a board temperature sensor.
+     * Both are off: PA0 to PA7 all carry the motor bridges on this board,
+     * so the default build has no compensation, and vbat, temp and vcomp
+     * answer Not Implemented. A board with a divider on a spare ADC pin
+     * defines VBAT_ADC as its channel here and sets VBAT_NOMINAL, the
+     * channels below are placeholders. "make check" covers the
+     * compensation with a host build that defines them. */
+    /* #define VBAT_ADC        0 */
+    /* #define TEMP_ADC        1 */
+    #define VBAT_NOMINAL        0x300
+    #define ADC_SLOW_WEIGHT     16
+
+    /* Bytes of the current capture buffer, see scope.h. A power of 2 up
+     * to 256, 256 samples at 8 bits and 128 at 10 bits. */
+    #define SCOPE_SIZE          256
+
+    /* Overcurrent cutoff, see fault.h. The limit is a raw sample of the
+     * current feedback, 0x3FF turns the cutoff off. It trips after the
+     * given number of samples above the limit in a row, so single spikes
+     * are ignored. Both can be changed at run time. */
+    #define OVERCURRENT_LIMIT   0x3FF
+    #define OVERCURRENT_SAMPLES 3
+
+    /* Failsafes, see failsafe.h. Without a new setpoint for
+     * FAILSAFE_TIMEOUT_MS the motors stop, 0 leaves them running. It is
+     * off by default, as speeds set by hand on the console would stop
+     * between two typed commands, a host streaming setpoints turns it on
+     * with the failsafe property. The watchdog timeout is one of the WDTO_*
+     * values of avr/wdt.h and must cover the longest pass of the main
+     * loop, printing a report at 9600 baud takes about half a second. */
+    #define FAILSAFE_TIMEOUT_MS 0
+    #define WATCHDOG_TIMEOUT    WDTO_1S
+
+    /* Profiling, see prof.h. Costs a 10 kHz timer interrupt and the
+     * overhead of every probe, so it is off unless asked for with
+     * make DEFS=-DPROF_ENABLE=1 */
+    #ifndef PROF_ENABLE
+    #define PROF_ENABLE 0
+    #endif
    
     /* Leds */
     #define LEDREG          PORTC
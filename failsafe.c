@@ -0,0 +1,63 @@
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include "config.h"
+#include "motor.h"
+#include "tick.h"
+#include "torque.h"
+#include "failsafe.h"
+
+/* Set before the C runtime clears .bss, so it must stay out of it. */
+static uint8_t failsafeReset __attribute__((section(".noinit")));
+static uint16_t failsafeTimeout = FAILSAFE_TIMEOUT_MS;
+static uint16_t failsafeDeadline;
+static uint8_t failsafeArmed;
+
+/* Runs from .init3, before the C runtime sets up the variables and long
+ * before main(): after a watchdog reset the watchdog stays on at its
+ * shortest timeout and would reset the controller again on the way. */
+#ifdef HAL_HOST
+__attribute__((constructor))
+#else
+__attribute__((naked, used, section(".init3")))
+#endif /* HAL_HOST */
+static void failsafeSaveReset(void) {
+    failsafeReset = MCUSR;
+    /* WDRF must be cleared, or the watchdog can not be turned off or
+     * slowed down and keeps resetting the controller. */
+    MCUSR = 0;
+    wdt_disable();
+}
+
+void initWatchdog(void) {
+    wdt_enable(WATCHDOG_TIMEOUT);
+}
+
+uint8_t failsafeResetCause(void) {
+    return failsafeReset;
+}
+
+void failsafeSetTimeout(uint16_t ms) {
+    failsafeTimeout = ms;
+    failsafeArmed = 0;
+}
+
+uint16_t failsafeGetTimeout(void) {
+    return failsafeTimeout;
+}
+
+void failsafeFeed(void) {
+    if (!failsafeTimeout) return;
+    failsafeDeadline = tickNow() + failsafeTimeout;
+    failsafeArmed = 1;
+}
+
+void failsafePoll(void) {
+    if (failsafeArmed && tickElapsed(failsafeDeadline)) {
+        /* The host went quiet, stop rather than run on, at the
+         * deceleration set for each motor. */
+        failsafeArmed = 0;
+        torqueOff(1);
+        torqueOff(2);
+        setSpeeds(0, 0);
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef FAILSAFE_H_
+#define FAILSAFE_H_
+
+/* Failsafes against a lost link and a hung firmware.
+ *
+ * Once armed by a setpoint, the link timeout stops both motors unless
+ * another setpoint arrives within the timeout, see the failsafe property.
+ * The hardware watchdog resets the controller if the main loop stops
+ * coming round, the bridges are off after a reset. */
+
+/* Arms the watchdog. The reset cause is saved and the watchdog turned off
+ * before main() is reached, see failsafe.c. */
+void initWatchdog(void);
+
+/* Returns the MCUSR reset flags of the last reset. */
+uint8_t failsafeResetCause(void);
+
+/* Sets the link timeout in milliseconds, 0 turns it off. Disarms it until
+ * the next setpoint. */
+void failsafeSetTimeout(uint16_t ms);
+uint16_t failsafeGetTimeout(void);
+
+/* Called with every valid setpoint, restarts the link timeout. */
+void failsafeFeed(void);
+
+/* Called from the main loop, stops the motors once the link timed out. */
+void failsafePoll(void);
+
+#endif /* FAILSAFE_H_ */
@@ -0,0 +1,166 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+#include "config.h"
+#include "motor.h"
+#include "fault.h"
+#include "scope.h"
+
+/* The compare outputs that carry the PWM of each bridge. */
+#if DISABLE_PWM
+    #define FAULT_M1_COM    (1<<COM0A1)
+    #define FAULT_M2_COM    (1<<COM1A1)
+#else
+    #define FAULT_M1_COM    ((1<<COM0A1) | (1<<COM0B1))
+    #define FAULT_M2_COM    ((1<<COM1A1) | (1<<COM1B1))
+#endif /* DISABLE_PWM */
+
+static volatile uint8_t faultLatched;
+static volatile uint8_t faultNew;
+static volatile uint8_t faultEnable;    /* Bridges cleared, see faultTick(). */
+
+faultCurrent faultCurrents[2] = {
+    { OVERCURRENT_LIMIT, 0, FAULT_M1_CURRENT, 0 },
+    { OVERCURRENT_LIMIT, 0, FAULT_M2_CURRENT, 0 },
+};
+
+uint8_t faultSamples = OVERCURRENT_SAMPLES;
+
+static inline void faultShutdown(uint8_t bits) __attribute__((always_inline));
+static inline void faultShutdown(uint8_t bits) {
+    /* Turns off the bridges of new faults, same as setEnableM1(0) or
+     * setEnableM2(0) but without the call overhead, and latches them.
+     * Only called with interrupts disabled. */
+    bits &= ~faultLatched;
+    if (bits & FAULT_M1_ANY) {
+        M1_REG &= ~(M1_ENABLE);
+        TCCR0A &= ~FAULT_M1_COM;
+    }
+    if (bits & FAULT_M2_ANY) {
+        M2_REG &= ~(M2_ENABLE);
+        TCCR1A &= ~FAULT_M2_COM;
+    }
+    faultLatched |= bits;
+    faultNew |= bits;
+    /* The bridges are off, a capture can take its time. */
+    if (bits) scopeTrigger(SCOPE_TRIG_FAULT);
+}
+
+static inline uint8_t faultInputs(void) {
+    /* Returns the FAULT_Mx bits of the fault inputs that are low. */
+    uint8_t active = ~M1_PIN;
+    uint8_t bits = 0;
+
+    if (active & M1_FAULT) bits |= FAULT_M1;
+    if (active & M2_FAULT) bits |= FAULT_M2;
+    return bits;
+}
+
+void initFault(void) {
+    /* Both fault inputs sit on port A, PCINT0 to PCINT7.
+     * The outputs are open drain, enable the pull-ups. */
+    M1_DDR &= ~(M1_FAULT | M2_FAULT);
+    M1_REG |= (M1_FAULT | M2_FAULT);
+    /* Let the pull-ups charge the lines before looking at them. */
+    _delay_us(10);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        PCMSK0 |= (1<<PCINT2) | (1<<PCINT6);
+        PCIFR = (1<<PCIF0);
+        PCICR |= (1<<PCIE0);
+        /* No edge for a fault that was there before. */
+        faultShutdown(faultInputs());
+    }
+}
+
+void faultTrip(uint8_t bits) {
+    faultShutdown(bits);
+}
+
+uint8_t faultGet(void) {
+    return faultLatched;
+}
+
+uint8_t faultPoll(void) {
+    uint8_t bits;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        bits = faultNew;
+        faultNew = 0;
+    }
+    return bits;
+}
+
+uint8_t faultClear(void) {
+    uint8_t keep;
+    uint8_t cleared;
+    uint8_t enable = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        keep = faultLatched & faultInputs();
+        cleared = faultLatched & ~keep;
+        faultLatched = keep;
+        faultCurrents[0].over = 0;
+        faultCurrents[1].over = 0;
+    }
+
+    /* The duty cycle from before the fault may still be in the compare
+     * registers, the tick waits for the zero speed to take over. */
+    if ((cleared & FAULT_M1_ANY) && !(keep & FAULT_M1_ANY)) {
+        stopM1();
+        enable |= FAULT_M1_ANY;
+    }
+    if ((cleared & FAULT_M2_ANY) && !(keep & FAULT_M2_ANY)) {
+        stopM2();
+        enable |= FAULT_M2_ANY;
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        faultEnable |= enable;
+    }
+    return keep;
+}
+
+void faultTick(void) {
+    uint8_t enable = faultEnable;
+
+    if (!enable || motorBusy()) return;
+    faultEnable = 0;
+    /* Faults coming back in between turn the bridge off again. */
+    if ((enable & FAULT_M1_ANY) && !(faultLatched & FAULT_M1_ANY)) setEnableM1(1);
+    if ((enable & FAULT_M2_ANY) && !(faultLatched & FAULT_M2_ANY)) setEnableM2(1);
+}
+
+uint16_t faultGetLimit(uint8_t motor) {
+    uint16_t limit;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        limit = faultCurrents[motor - 1].limit;
+    }
+    return limit;
+}
+
+void faultSetLimit(uint8_t motor, uint16_t limit) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        faultCurrents[motor - 1].limit = limit;
+    }
+}
+
+uint16_t faultGetTrips(uint8_t motor) {
+    uint16_t trips;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        trips = faultCurrents[motor - 1].trips;
+    }
+    return trips;
+}
+
+void faultClearTrips(uint8_t motor) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        faultCurrents[motor - 1].trips = 0;
+    }
+}
+
+ISR(PCINT0_vect) {
+    faultShutdown(faultInputs());
+}
@@ -0,0 +1,78 @@
+#ifndef FAULT_H_
+#define FAULT_H_
+
+/* H-bridge fault shutdown.
+ *
+ * The fault outputs of the bridges (M1_FAULT, M2_FAULT, active low) raise
+ * a pin change interrupt, which turns the faulty bridge off right away and
+ * latches the fault. The ADC interrupt does the same when the current of
+ * a motor stays above its limit for a number of samples in a row.
+ * A bridge stays off until its faults are cleared, see the fault property. */
+
+/* Fault bits, as read from the fault property. */
+#define FAULT_M1            0x01    /* Fault output of the bridge. */
+#define FAULT_M2            0x02
+#define FAULT_M1_CURRENT    0x04    /* Overcurrent. */
+#define FAULT_M2_CURRENT    0x08
+
+#define FAULT_M1_ANY        (FAULT_M1 | FAULT_M1_CURRENT)
+#define FAULT_M2_ANY        (FAULT_M2 | FAULT_M2_CURRENT)
+
+/* Overcurrent cutoff of one motor. */
+typedef struct faultCurrent_ {
+    uint16_t limit;     /* Highest raw ADC sample that is not overcurrent. */
+    uint8_t over;       /* Samples above the limit in a row. */
+    uint8_t fault;      /* FAULT_Mx_CURRENT. */
+    uint16_t trips;     /* Times the cutoff tripped, stops at 0xFFFF. */
+} faultCurrent;
+
+/* Indexed by motor - 1. */
+extern faultCurrent faultCurrents[2];
+
+/* Samples above the limit in a row that trip the cutoff. */
+extern uint8_t faultSamples;
+
+/* Sets up the fault inputs and their interrupt. A fault present already
+ * is latched at once. Call after the bridges are enabled. */
+void initFault(void);
+
+/* Turns off the bridges of the given FAULT_* bits and latches them.
+ * Only call with interrupts disabled. */
+void faultTrip(uint8_t bits);
+
+static inline void faultCheckCurrent(faultCurrent *current, uint16_t sample) {
+    /* Called by the ADC interrupt with every current sample of a motor. */
+    if (sample <= current->limit) {
+        current->over = 0;
+    } else if (current->over < faultSamples) {
+        /* Trips once per overcurrent, until it ends or is cleared. */
+        if (++current->over == faultSamples) {
+            faultTrip(current->fault);
+            if (current->trips != 0xFFFF) current->trips++;
+        }
+    }
+}
+
+/* Returns the latched FAULT_* bits. */
+uint8_t faultGet(void);
+
+/* Returns the FAULT_* bits latched since the last call, for reporting. */
+uint8_t faultPoll(void);
+
+/* Clears the overcurrent faults and the latched faults whose input has
+ * gone inactive, and stops the motors left without faults. Returns the
+ * FAULT_* bits still latched. Their bridges are enabled again by
+ * faultTick() once the zero speed is in effect, see motorBusy(), after
+ * at most three PWM periods. */
+uint8_t faultClear(void);
+
+/* Finishes faultClear(), called every millisecond by the tick interrupt. */
+void faultTick(void);
+
+/* Accessors of faultCurrents[], safe against the ADC interrupt. */
+uint16_t faultGetLimit(uint8_t motor);
+void faultSetLimit(uint8_t motor, uint16_t limit);
+uint16_t faultGetTrips(uint8_t motor);
+void faultClearTrips(uint8_t motor);
+
+#endif /* FAULT_H_ */
@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "fmt.h"
+
+#define FMT_DIGITS 5
+
+static const char fmtHexDigits[] PROGMEM = "0123456789ABCDEF";
+static const uint16_t fmtPowers[FMT_DIGITS] PROGMEM = { 10000, 1000, 100, 10, 1 };
+
+uint8_t fmtHex(char *buf, uint16_t num) {
+    int8_t shift;
+    uint8_t pos = 0;
+    uint8_t nibble;
+
+    buf[pos++] = '0';
+    buf[pos++] = 'x';
+    for (shift = 12; shift >= 0; shift -= 4) {
+        nibble = (num >> shift) & 0x0F;
+        /* Always store the last nibble, so zero comes out as 0x0. */
+        if (nibble || (pos > 2) || (shift == 0)) {
+            buf[pos++] = pgm_read_byte(&fmtHexDigits[nibble]);
+        }
+    }
+    return pos;
+}
+
+static uint8_t fmtDigits(char *buf, uint16_t num, uint8_t decimals) {
+    /* Stores num in decimal, with a point before the last decimals digits. */
+    uint8_t i;
+    uint8_t exponent;
+    uint8_t pos = 0;
+    uint16_t power;
+    char digit;
+
+    for (i = 0; i < FMT_DIGITS; i++) {
+        power = pgm_read_word(&fmtPowers[i]);
+        exponent = FMT_DIGITS - 1 - i;
+        digit = '0';
+        while (num >= power) {
+            num -= power;
+            digit++;
+        }
+        if (decimals && (exponent == decimals - 1)) {
+            buf[pos++] = '.';
+        }
+        /* Skip leading zeros but keep the integer digit and all decimals. */
+        if ((digit != '0') || pos || (exponent <= decimals)) {
+            buf[pos++] = digit;
+        }
+    }
+    return pos;
+}
+
+uint8_t fmtUDec(char *buf, uint16_t num) {
+    return fmtDigits(buf, num, 0);
+}
+
+uint8_t fmtDec(char *buf, int16_t num) {
+    return fmtFixed(buf, num, 0);
+}
+
+uint8_t fmtFixed(char *buf, int16_t num, uint8_t decimals) {
+    if (num < 0) {
+        buf[0] = '-';
+        /* The cast keeps -32768 intact. */
+        return 1 + fmtDigits(buf + 1, -(uint16_t)num, decimals);
+    }
+    return fmtDigits(buf, num, decimals);
+}
@@ -0,0 +1,27 @@
+#ifndef FMT_H_
+#define FMT_H_
+
+/* Number formatting without stdio.
+ *
+ * Digits are produced most significant first, by subtracting powers of ten
+ * from a table in flash, and stored in a buffer supplied by the caller so
+ * the result can be sent as one block. The buffer is not null terminated. */
+
+/* Longest result of any of the functions below, "-3.2768". */
+#define FMT_SIZE 7
+
+/* Stores num as hexadecimal with a 0x prefix and no leading zeros, "0x1A3".
+ * Returns the number of characters stored. */
+uint8_t fmtHex(char *buf, uint16_t num);
+
+/* Stores num as unsigned decimal. Returns the number of characters stored. */
+uint8_t fmtUDec(char *buf, uint16_t num);
+
+/* Stores num as signed decimal. Returns the number of characters stored. */
+uint8_t fmtDec(char *buf, int16_t num);
+
+/* Stores a fixed-point value with the given number of decimals (at most 4),
+ * 1250 with 3 decimals gives "1.250". Returns the number of characters stored. */
+uint8_t fmtFixed(char *buf, int16_t num, uint8_t decimals);
+
+#endif /* FMT_H_ */
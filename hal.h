@@ -0,0 +1,46 @@
+#ifndef HAL_H_
+#define HAL_H_
+
+/* Hardware abstraction.
+ *
+ * The firmware reaches the hardware only through the avr-libc interface:
+ * the register and bit names of <avr/io.h>, ISR(), sei() and cli(),
+ * sleep_cpu(), ATOMIC_BLOCK() and the flash access of <avr/pgmspace.h>.
+ * On the target avr-libc is the backend.
+ *
+ * The host build (make host) puts host/ first on the include path, where
+ * the same headers map the registers onto an array in RAM, and
+ * host/host.c plays the part of the peripherals for a native Linux
+ * program running the unchanged main loop:
+ *
+ *  - Each USART is a pseudo terminal, its name is printed at start-up.
+ *    HOST_UART0=- or HOST_UART1=- puts the port on stdin and stdout
+ *    instead, the program then exits once the input is used up.
+ *  - Timer 2 raises its compare match interrupt in real time, and
+ *    timer 0 its overflow interrupt once per PWM period.
+ *  - Timer 1 sets its overflow and capture flags at BOTTOM and TOP.
+ *  - The ADC converts at its real speed and returns hostAdcInput[], it is
+ *    started by ADSC or auto triggered by the timer 1 flags.
+ *  - Input pins follow their pull-ups unless pulled low in hostPinLow[],
+ *    and raise pin change interrupts.
+ *  - The watchdog ends the program when it runs out.
+ *  - Every register change made by the firmware is logged to the file
+ *    named by HOST_TRACE, if set.
+ *
+ * Interrupts are delivered by sei(), sleep_cpu() and halWait(). */
+
+#ifdef HAL_HOST
+
+/* Delivers pending interrupts of the host backend. */
+void hostPoll(void);
+
+#define halWait()   hostPoll()
+
+#else
+
+/* Called in busy-wait loops. Interrupts need no help on the target. */
+#define halWait()
+
+#endif /* HAL_HOST */
+
+#endif /* HAL_H_ */
@@ -0,0 +1,18 @@
+#ifndef HOST_AVR_EEPROM_H_
+#define HOST_AVR_EEPROM_H_
+
+/* Host stand-in for <avr/eeprom.h>, see hal.h.
+ * EEPROM variables are ordinary variables, they start out with their
+ * initial value every run as if the .eeprom image had been programmed. */
+
+#define EEMEM
+
+#define eeprom_read_byte(addr)          (*(const uint8_t *)(addr))
+#define eeprom_read_word(addr)          (*(const uint16_t *)(addr))
+#define eeprom_update_byte(addr, value) (*(uint8_t *)(addr) = (value))
+#define eeprom_update_word(addr, value) (*(uint16_t *)(addr) = (value))
+#define eeprom_write_byte               eeprom_update_byte
+#define eeprom_write_word               eeprom_update_word
+#define eeprom_busy_wait()
+
+#endif /* HOST_AVR_EEPROM_H_ */
@@ -0,0 +1,17 @@
+#ifndef HOST_AVR_INTERRUPT_H_
+#define HOST_AVR_INTERRUPT_H_
+
+/* Host stand-in for <avr/interrupt.h>, see hal.h.
+ *
+ * An interrupt handler becomes a plain function named after its vector,
+ * host/host.c calls it while the I bit of SREG is set. */
+
+/* Sets the I bit and delivers what became pending meanwhile. */
+void hostSei(void);
+
+#define sei()   hostSei()
+#define cli()   (SREG &= ~0x80)
+
+#define ISR(vector, ...)    void vector(void)
+
+#endif /* HOST_AVR_INTERRUPT_H_ */
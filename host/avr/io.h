@@ -0,0 +1,330 @@
+#ifndef HOST_AVR_IO_H_
+#define HOST_AVR_IO_H_
+
+/* Host stand-in for <avr/io.h>, ATmega324PA only, see hal.h.
+ *
+ * The I/O registers live in hostIo[], indexed by their data space
+ * address, so 16-bit registers overlay their low and high bytes as on
+ * the target. Only the registers and bits the firmware uses, add more
+ * from the datasheet as needed. */
+
+#include <stdint.h>
+
+#ifndef __AVR_ATmega324PA__
+#define __AVR_ATmega324PA__
+#endif
+
+#define HOST_IO_SIZE    0x100
+
+extern volatile uint8_t hostIo[HOST_IO_SIZE];
+
+#define _SFR_MEM8(addr)     (hostIo[addr])
+#define _SFR_MEM16(addr)    (*(volatile uint16_t *)&hostIo[addr])
+
+#define _BV(bit)    (1 << (bit))
+
+#define RAMEND      0x8FF
+#define E2END       0x3FF
+
+/* Ports. */
+#define PINA    _SFR_MEM8(0x20)
+#define DDRA    _SFR_MEM8(0x21)
+#define PORTA   _SFR_MEM8(0x22)
+#define PINB    _SFR_MEM8(0x23)
+#define DDRB    _SFR_MEM8(0x24)
+#define PORTB   _SFR_MEM8(0x25)
+#define PINC    _SFR_MEM8(0x26)
+#define DDRC    _SFR_MEM8(0x27)
+#define PORTC   _SFR_MEM8(0x28)
+#define PIND    _SFR_MEM8(0x29)
+#define DDRD    _SFR_MEM8(0x2A)
+#define PORTD   _SFR_MEM8(0x2B)
+
+/* Interrupt flags and masks. */
+#define TIFR0   _SFR_MEM8(0x35)
+#define TIFR1   _SFR_MEM8(0x36)
+#define TIFR2   _SFR_MEM8(0x37)
+#define PCIFR   _SFR_MEM8(0x3B)
+#define EIFR    _SFR_MEM8(0x3C)
+#define EIMSK   _SFR_MEM8(0x3D)
+#define PCICR   _SFR_MEM8(0x68)
+#define EICRA   _SFR_MEM8(0x69)
+#define PCMSK0  _SFR_MEM8(0x6B)
+#define PCMSK1  _SFR_MEM8(0x6C)
+#define PCMSK2  _SFR_MEM8(0x6D)
+#define TIMSK0  _SFR_MEM8(0x6E)
+#define TIMSK1  _SFR_MEM8(0x6F)
+#define TIMSK2  _SFR_MEM8(0x70)
+#define PCMSK3  _SFR_MEM8(0x73)
+
+/* EEPROM. */
+#define EECR    _SFR_MEM8(0x3F)
+#define EEDR    _SFR_MEM8(0x40)
+#define EEAR    _SFR_MEM16(0x41)
+#define EEARL   _SFR_MEM8(0x41)
+#define EEARH   _SFR_MEM8(0x42)
+
+/* System. */
+#define GPIOR0  _SFR_MEM8(0x3E)
+#define GTCCR   _SFR_MEM8(0x43)
+#define SMCR    _SFR_MEM8(0x53)
+#define MCUSR   _SFR_MEM8(0x54)
+#define MCUCR   _SFR_MEM8(0x55)
+#define SREG    _SFR_MEM8(0x5F)
+#define WDTCSR  _SFR_MEM8(0x60)
+#define CLKPR   _SFR_MEM8(0x61)
+#define PRR0    _SFR_MEM8(0x64)
+
+/* Timer 0. */
+#define TCCR0A  _SFR_MEM8(0x44)
+#define TCCR0B  _SFR_MEM8(0x45)
+#define TCNT0   _SFR_MEM8(0x46)
+#define OCR0A   _SFR_MEM8(0x47)
+#define OCR0B   _SFR_MEM8(0x48)
+
+/* Timer 1. */
+#define TCCR1A  _SFR_MEM8(0x80)
+#define TCCR1B  _SFR_MEM8(0x81)
+#define TCCR1C  _SFR_MEM8(0x82)
+#define TCNT1   _SFR_MEM16(0x84)
+#define TCNT1L  _SFR_MEM8(0x84)
+#define TCNT1H  _SFR_MEM8(0x85)
+#define ICR1    _SFR_MEM16(0x86)
+#define ICR1L   _SFR_MEM8(0x86)
+#define ICR1H   _SFR_MEM8(0x87)
+#define OCR1A   _SFR_MEM16(0x88)
+#define OCR1AL  _SFR_MEM8(0x88)
+#define OCR1AH  _SFR_MEM8(0x89)
+#define OCR1B   _SFR_MEM16(0x8A)
+#define OCR1BL  _SFR_MEM8(0x8A)
+#define OCR1BH  _SFR_MEM8(0x8B)
+
+/* Timer 2. */
+#define TCCR2A  _SFR_MEM8(0xB0)
+#define TCCR2B  _SFR_MEM8(0xB1)
+#define TCNT2   _SFR_MEM8(0xB2)
+#define OCR2A   _SFR_MEM8(0xB3)
+#define OCR2B   _SFR_MEM8(0xB4)
+#define ASSR    _SFR_MEM8(0xB6)
+
+/* ADC. */
+#define ADC     _SFR_MEM16(0x78)
+#define ADCW    _SFR_MEM16(0x78)
+#define ADCL    _SFR_MEM8(0x78)
+#define ADCH    _SFR_MEM8(0x79)
+#define ADCSRA  _SFR_MEM8(0x7A)
+#define ADCSRB  _SFR_MEM8(0x7B)
+#define ADMUX   _SFR_MEM8(0x7C)
+#define DIDR0   _SFR_MEM8(0x7E)
+#define DIDR1   _SFR_MEM8(0x7F)
+
+/* USART0. */
+#define UCSR0A  _SFR_MEM8(0xC0)
+#define UCSR0B  _SFR_MEM8(0xC1)
+#define UCSR0C  _SFR_MEM8(0xC2)
+#define UBRR0   _SFR_MEM16(0xC4)
+#define UBRR0L  _SFR_MEM8(0xC4)
+#define UBRR0H  _SFR_MEM8(0xC5)
+#define UDR0    _SFR_MEM8(0xC6)
+
+/* USART1. */
+#define UCSR1A  _SFR_MEM8(0xC8)
+#define UCSR1B  _SFR_MEM8(0xC9)
+#define UCSR1C  _SFR_MEM8(0xCA)
+#define UBRR1   _SFR_MEM16(0xCC)
+#define UBRR1L  _SFR_MEM8(0xCC)
+#define UBRR1H  _SFR_MEM8(0xCD)
+#define UDR1    _SFR_MEM8(0xCE)
+
+/* Bits. */
+#define PA0 0
+#define PA1 1
+#define PA2 2
+#define PA3 3
+#define PA4 4
+#define PA5 5
+#define PA6 6
+#define PA7 7
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PC7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+#define PCINT0 0
+#define PCINT1 1
+#define PCINT2 2
+#define PCINT3 3
+#define PCINT4 4
+#define PCINT5 5
+#define PCINT6 6
+#define PCINT7 7
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define PCIE3 3
+#define PCIF0 0
+#define COM0A1 7
+#define COM0A0 6
+#define COM0B1 5
+#define COM0B0 4
+#define WGM01 1
+#define WGM00 0
+#define FOC0A 7
+#define FOC0B 6
+#define WGM02 3
+#define CS02 2
+#define CS01 1
+#define CS00 0
+#define TOIE0 0
+#define OCIE0A 1
+#define OCIE0B 2
+#define TOV0 0
+#define OCF0A 1
+#define OCF0B 2
+#define COM1A1 7
+#define COM1A0 6
+#define COM1B1 5
+#define COM1B0 4
+#define WGM11 1
+#define WGM10 0
+#define ICNC1 7
+#define ICES1 6
+#define WGM13 4
+#define WGM12 3
+#define CS12 2
+#define CS11 1
+#define CS10 0
+#define TOIE1 0
+#define OCIE1A 1
+#define OCIE1B 2
+#define ICIE1 5
+#define TOV1 0
+#define OCF1A 1
+#define OCF1B 2
+#define ICF1 5
+#define COM2A1 7
+#define COM2A0 6
+#define WGM21 1
+#define WGM20 0
+#define WGM22 3
+#define CS22 2
+#define CS21 1
+#define CS20 0
+#define TOIE2 0
+#define OCIE2A 1
+#define OCIE2B 2
+#define TOV2 0
+#define OCF2A 1
+#define OCF2B 2
+#define TSM 7
+#define PSRASY 1
+#define PSRSYNC 0
+#define REFS1 7
+#define REFS0 6
+#define ADLAR 5
+#define MUX4 4
+#define MUX3 3
+#define MUX2 2
+#define MUX1 1
+#define MUX0 0
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define ACME 6
+#define ADTS2 2
+#define ADTS1 1
+#define ADTS0 0
+#define ADC0D 0
+#define ADC7D 7
+#define RXC0 7
+#define TXC0 6
+#define UDRE0 5
+#define FE0 4
+#define DOR0 3
+#define UPE0 2
+#define U2X0 1
+#define MPCM0 0
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0 4
+#define TXEN0 3
+#define UCSZ02 2
+#define RXB80 1
+#define TXB80 0
+#define UMSEL01 7
+#define UMSEL00 6
+#define UPM01 5
+#define UPM00 4
+#define USBS0 3
+#define UCSZ01 2
+#define UCSZ00 1
+#define UCPOL0 0
+#define RXC1 7
+#define TXC1 6
+#define UDRE1 5
+#define FE1 4
+#define DOR1 3
+#define UPE1 2
+#define U2X1 1
+#define MPCM1 0
+#define RXCIE1 7
+#define TXCIE1 6
+#define UDRIE1 5
+#define RXEN1 4
+#define TXEN1 3
+#define UCSZ12 2
+#define UMSEL11 7
+#define UMSEL10 6
+#define UPM11 5
+#define UPM10 4
+#define USBS1 3
+#define UCSZ11 2
+#define UCSZ10 1
+#define UCPOL1 0
+#define WDIF 7
+#define WDIE 6
+#define WDP3 5
+#define WDCE 4
+#define WDE 3
+#define WDP2 2
+#define WDP1 1
+#define WDP0 0
+#define WDRF 3
+#define BORF 2
+#define EXTRF 1
+#define PORF 0
+#define SM2 3
+#define SM1 2
+#define SM0 1
+#define SE 0
+#define EERE 0
+#define EEPE 1
+#define EEMPE 2
+#define EERIE 3
+
+#endif /* HOST_AVR_IO_H_ */
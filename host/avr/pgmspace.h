@@ -0,0 +1,24 @@
+#ifndef HOST_AVR_PGMSPACE_H_
+#define HOST_AVR_PGMSPACE_H_
+
+/* Host stand-in for <avr/pgmspace.h>, see hal.h.
+ * There is only one address space, flash data is ordinary const data. */
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P               const char *
+#define PSTR(s)             (s)
+
+/* Reads through the type of the pointer, so a "word" read of a pointer
+ * in a table fetches all of it. */
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(addr))
+
+#define memcpy_P            memcpy
+#define strlen_P            strlen
+#define strcmp_P            strcmp
+#define strncmp_P           strncmp
+
+#endif /* HOST_AVR_PGMSPACE_H_ */
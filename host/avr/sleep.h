@@ -0,0 +1,19 @@
+#ifndef HOST_AVR_SLEEP_H_
+#define HOST_AVR_SLEEP_H_
+
+/* Host stand-in for <avr/sleep.h>, see hal.h. */
+
+/* Waits for input or the next timer interrupt, then delivers it. */
+void hostSleep(void);
+
+#define SLEEP_MODE_IDLE         0
+#define SLEEP_MODE_ADC          _BV(SM0)
+#define SLEEP_MODE_PWR_DOWN     _BV(SM1)
+
+#define set_sleep_mode(mode)    (SMCR = (SMCR & ~(_BV(SM0) | _BV(SM1) | _BV(SM2))) | (mode))
+#define sleep_enable()          (SMCR |= _BV(SE))
+#define sleep_disable()         (SMCR &= ~_BV(SE))
+#define sleep_cpu()             hostSleep()
+#define sleep_mode()            do { sleep_enable(); sleep_cpu(); sleep_disable(); } while (0)
+
+#endif /* HOST_AVR_SLEEP_H_ */
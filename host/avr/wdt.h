@@ -0,0 +1,29 @@
+#ifndef HOST_AVR_WDT_H_
+#define HOST_AVR_WDT_H_
+
+/* Host stand-in for <avr/wdt.h>, see hal.h.
+ *
+ * The host backend checks the watchdog whenever it delivers interrupts,
+ * and ends the program if it was not reset within the timeout. */
+
+#define WDTO_15MS   0
+#define WDTO_30MS   1
+#define WDTO_60MS   2
+#define WDTO_120MS  3
+#define WDTO_250MS  4
+#define WDTO_500MS  5
+#define WDTO_1S     6
+#define WDTO_2S     7
+#define WDTO_4S     8
+#define WDTO_8S     9
+
+extern volatile uint8_t hostWdtFed;
+
+/* Sets WDTCSR as the target does. */
+void hostWdtEnable(uint8_t value);
+
+#define wdt_enable(value)   hostWdtEnable(value)
+#define wdt_disable()       (WDTCSR = 0)
+#define wdt_reset()         (hostWdtFed = 1)
+
+#endif /* HOST_AVR_WDT_H_ */
@@ -0,0 +1,300 @@
+#!/bin/sh
+# Checks of the host build, see hal.h. Each check types a session into the
+# console of the firmware and looks at the replies. Run by "make check".
+
+PRG=${1:-host/main}
+failed=0
+
+# Variants are built into a scratch directory, see variant().
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# Types the arguments as console lines, "sleep n" pauses instead.
+session() {
+    for line in "$@"; do
+        case "$line" in
+            sleep\ *) $line ;;
+            *) printf '%s\r' "$line"; sleep 0.05 ;;
+        esac
+    done | HOST_UART1=- timeout 10 "$PRG" 2>/dev/null | tr -d '\r'
+}
+
+# Prints the reply to a line of a session, the line after its echo, or
+# after its nth echo if given a count.
+reply() {
+    printf '%s\n' "$1" | awk -v line="$2" -v n="${3:-1}" \
+        'found { print; exit } { sub(/^# /, "") } $0 == line && ++seen == n { found = 1 }'
+}
+
+# Compares a reply to an extended regular expression.
+check() {
+    if printf '%s\n' "$2" | grep -Eqx -- "$3"; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1: got '$2', expected '$3'"
+        failed=1
+    fi
+}
+
+# Switches the console to the binary protocol and sends frames, see
+# proto.h. A frame is given as a printf format of its bytes, escaped and
+# with the crc, and goes out between two PROTO_END. "sleep n" pauses.
+# Prints what comes back, in hex.
+bsession() {
+    {
+        # Bytes that come in before the switch are taken as text.
+        printf 'set uart1mode 1\r'
+        sleep 0.3
+        for frame in "$@"; do
+            case "$frame" in
+                sleep\ *) $frame ;;
+                *) printf "\300$frame\300"; sleep 0.05 ;;
+            esac
+        done
+    } | HOST_UART1=- timeout 10 "$PRG" 2>/dev/null | od -An -v -tx1
+}
+
+# Splits the output of bsession() into frames, one per line in hex and
+# unescaped, each followed by "ok" or "bad" for its crc. The console text
+# ahead of the first frame is dropped.
+frames() {
+    printf '%s\n' "$1" | awk '
+        function xor(a, b,    r, bit) {
+            r = 0
+            for (bit = 1; bit < 256; bit *= 2) {
+                if (int(a / bit) % 2 != int(b / bit) % 2) r += bit
+            }
+            return r
+        }
+        function end(    crc, i, k, line) {
+            crc = 0
+            line = ""
+            for (i = 0; i < n; i++) {
+                crc = xor(crc, value[frame[i]])
+                for (k = 0; k < 8; k++) crc = (crc >= 128) ? xor(crc * 2 - 256, 7) : crc * 2
+                line = line frame[i] " "
+            }
+            print line (crc ? "bad" : "ok")
+        }
+        BEGIN { for (i = 0; i < 256; i++) value[sprintf("%02x", i)] = i }
+        {
+            for (i = 1; i <= NF; i++) {
+                b = $i
+                if (b == "c0") {
+                    if (n) end()
+                    n = 0
+                    binary = 1
+                } else if (!binary) {
+                    if (b == "0a") n = 0
+                    else frame[n++] = b
+                } else if (b == "db") {
+                    escape = 1
+                } else {
+                    if (escape) b = (b == "dc") ? "c0" : (b == "dd") ? "db" : b
+                    escape = 0
+                    frame[n++] = b
+                }
+            }
+        }
+        END { if (n) end() }'
+}
+
+# Builds a variant of the host build with the load model check/load.c
+# and the compiler options given, run it with PRG=$tmp/name. Needs the
+# sources and options of the host build, as passed by "make check".
+variant() {
+    name=$1
+    shift
+    if [ -z "$HOSTSRC" ]; then
+        echo "skip $name: needs HOSTSRC, run make check"
+        return 1
+    fi
+    if ! ${HOSTCC:-cc} $HOSTCFLAGS "$@" -o "$tmp/$name" $HOSTSRC host/check/load.c; then
+        echo "FAIL $name: does not build"
+        failed=1
+        return 1
+    fi
+}
+
+# Names resolve by any unique prefix, see cmdLookup().
+out=$(session "get m1sp" "get m1d" "get nothing" "frob")
+check "prefix lookup" "$(reply "$out" "get m1sp")" "0"
+check "ambiguous prefix" "$(reply "$out" "get m1d")" "Error: Ambiguous property\."
+check "unknown property" "$(reply "$out" "get nothing")" "Error: Invalid property\."
+check "unknown command" "$(reply "$out" "frob")" "Invalid command"
+
+# Reports share the name space, "p" is both pwmfreq and the prof report.
+# An unknown name is reported before the value is looked at.
+out=$(session "get p" "set nothing abc")
+check "ambiguous with a report" "$(reply "$out" "get p")" "Error: Ambiguous property\."
+check "unknown property to set" "$(reply "$out" "set nothing abc")" "Error: Invalid property\."
+
+# A value out of range is refused and leaves the property as it was.
+out=$(session "set led2 2" "get led2")
+check "range error" "$(reply "$out" "set led2 2")" "Error: Value out of range\."
+check "range error keeps the value" "$(reply "$out" "get led2")" "0"
+out=$(session "set led2 1" "get led2")
+check "set and get" "$(reply "$out" "get led2")" "1"
+
+# The reset cause is saved before the C runtime starts, the host starts
+# from a power-on reset.
+out=$(session "get reset")
+check "reset cause" "$(reply "$out" "get reset")" "0x1"
+
+# Numbers are parsed and printed without stdio, see astring.h and fmt.h.
+# Fixed point values take up to their decimals, more are dropped.
+out=$(session "set torquekp 1.5" "get torquekp" "set torquekp .25" "get torquekp" \
+              "set torquekp 0.0005" "get torquekp" "set torquekp 32.767" "get torquekp" \
+              "set torquekp 32.768" "set torquekp 1.2.3" "set torquekp ." "set torquekp 99999999999.5")
+check "fixed point" "$(reply "$out" "get torquekp" 1)" "1\.500"
+check "fixed point fraction only" "$(reply "$out" "get torquekp" 2)" "0\.250"
+check "fixed point extra decimals" "$(reply "$out" "get torquekp" 3)" "0\.000"
+check "fixed point largest" "$(reply "$out" "get torquekp" 4)" "32\.767"
+check "fixed point above range" "$(reply "$out" "set torquekp 32.768")" "Error: Value out of range\."
+check "fixed point two points" "$(reply "$out" "set torquekp 1.2.3")" "Error: Expected integer\."
+check "fixed point no digits" "$(reply "$out" "set torquekp .")" "Error: Expected integer\."
+check "fixed point overflow" "$(reply "$out" "set torquekp 99999999999.5")" "Error: Value out of range\."
+out=$(session "set m1duty -0x3FF" "get m1duty" "set m1duty +7" "get m1duty" "set m1duty 2147483648" \
+              "set m1duty -2147483648" "set m1duty 12a" "set m1duty 0x" "set m1duty -" \
+              "set pwmfreq 39216" "get pwmfreq" "get m1current")
+check "negative hex" "$(reply "$out" "get m1duty" 1)" "-1023"
+check "plus sign" "$(reply "$out" "get m1duty" 2)" "7"
+check "integer overflow" "$(reply "$out" "set m1duty 2147483648")" "Error: Value out of range\."
+check "integer lowest" "$(reply "$out" "set m1duty -2147483648")" "Error: Value out of range\."
+check "integer bad digit" "$(reply "$out" "set m1duty 12a")" "Error: Expected integer\."
+check "integer empty hex" "$(reply "$out" "set m1duty 0x")" "Error: Expected integer\."
+check "integer sign only" "$(reply "$out" "set m1duty -")" "Error: Expected integer\."
+check "unsigned above 32767" "$(reply "$out" "get pwmfreq")" "39216"
+check "hex zero" "$(reply "$out" "get m1current")" "0x0"
+
+# Binary frames, see proto.h. A value of 0xC0 or 0xDB is escaped both
+# ways, requests that fail are answered with a NACK and the reason.
+# Sent: set m1duty 0xC0, get m1duty, set m1duty 0xDB, get m1duty,
+# get led2 with a bad crc, set led2 with three bytes, an ACK from the
+# host, get of property 63, set led2 2 and get led2.
+out=$(frames "$(bsession '\033\333\334\000\243' '\133\206' '\033\333\335\000\143' '\133\206' \
+                         '\106\000' '\006\001\000\000\037' '\206\233' '\177\172' '\006\002\160' '\106\325')")
+check "binary set" "$(printf '%s\n' "$out" | sed -n 1p)" "9b c8 ok"
+check "binary escaped end" "$(printf '%s\n' "$out" | sed -n 2p)" "9b c0 00 a8 ok"
+check "binary escaped esc" "$(printf '%s\n' "$out" | sed -n 4p)" "9b db 00 68 ok"
+check "binary bad crc" "$(printf '%s\n' "$out" | sed -n 5p)" "e0 ae ok"
+check "binary bad length" "$(printf '%s\n' "$out" | sed -n 6p)" "e1 a9 ok"
+check "binary bad opcode" "$(printf '%s\n' "$out" | sed -n 7p)" "e2 a0 ok"
+check "binary unknown property" "$(printf '%s\n' "$out" | sed -n 8p)" "c1 49 ok"
+check "binary range error" "$(printf '%s\n' "$out" | sed -n 9p)" "c4 52 ok"
+check "binary get" "$(printf '%s\n' "$out" | sed -n 10p)" "86 00 00 76 ok"
+
+# A PWM frequency far from the available ones is refused, a near one is
+# rounded to it, see setPwmFreq().
+out=$(session "set pwmfreq 20000" "get pwmfreq")
+check "pwm frequency out of reach" "$(reply "$out" "set pwmfreq 20000")" "Error: Value out of range\."
+check "pwm frequency kept" "$(reply "$out" "get pwmfreq")" "153"
+out=$(session "set pwmfreq 4000" "get pwmfreq")
+check "pwm frequency rounded" "$(reply "$out" "get pwmfreq")" "4902"
+
+# Reversing from a standstill accelerates, even without a decel limit.
+# 100 units per second for 0.3 s.
+out=$(session "set m1accel 100" "set m1decel 0" "set m1speed -127" "sleep 0.3" "get m1ramp")
+check "ramp reverse from standstill" "$(reply "$out" "get m1ramp")" "-(2[0-9]|3[0-9]|40)"
+
+# A line queued at the old rate does not confirm the new one, the port
+# falls back after SERIAL_FALLBACK_MS.
+out=$(session "set uart1baud 1152$(printf '\r')get led1" "sleep 2.5" "get uart1baud")
+check "baud switch needs a line at the new rate" "$(reply "$out" "get uart1baud")" "576"
+
+# The filters of the current feedback, see adc.h. The samples alternate
+# between 100 and 101, a mean of 100.5 or 0x324 in eighths, which any
+# even block length gets exactly and the low-pass settles near, give or
+# take half a count for late dithering.
+if variant load; then
+    export LOAD_OFFSET=100 LOAD_DITHER=1
+    out=$(PRG=$tmp/load session "set pwmfreq 613" "set adcavg 16" "sleep 0.5" "get m1avg" "get m1filt")
+    check "oversample 16" "$(reply "$out" "get m1avg")" "0x324"
+    check "low-pass 8" "$(reply "$out" "get m1filt")" "0x32[0-8]"
+    out=$(PRG=$tmp/load session "set pwmfreq 613" "set adcavg 64" "set adcfilt 5" "sleep 0.8" "get m1avg" "get m1filt")
+    check "oversample 64" "$(reply "$out" "get m1avg")" "0x324"
+    check "low-pass 32" "$(reply "$out" "get m1filt")" "0x32[0-8]"
+    out=$(PRG=$tmp/load session "set pwmfreq 613" "set adcavg 1" "set adcfilt 0" "sleep 0.1" "get m1avg" "get m1filt")
+    check "oversample 1" "$(reply "$out" "get m1avg")" "0x32[08]"
+    check "low-pass off" "$(reply "$out" "get m1filt")" "0x32[08]"
+    unset LOAD_OFFSET LOAD_DITHER
+fi
+
+# A fault of the bridge turns it off and latches, see fault.h. It can
+# only be cleared once the fault output is back, and leaves the motor
+# stopped. The fault output of bridge 1 is active from 0.3 s to 0.8 s.
+if variant load; then
+    export LOAD_FAULT_AT=300 LOAD_FAULT_FOR=500
+    out=$(PRG=$tmp/load session "set m1duty 500" "sleep 0.4" "get fault" "get m1current" "set fault 0" \
+                                "sleep 0.3" "get m1duty" "set fault 0" "get fault" "sleep 0.1" "get m1duty" \
+                                "set m1duty 400" "sleep 0.1" "get m1current")
+    unset LOAD_FAULT_AT LOAD_FAULT_FOR
+    check "fault latched" "$(reply "$out" "get fault")" "0x1"
+    check "fault turns the bridge off" "$(reply "$out" "get m1current")" "0x0"
+    check "fault clear while active" "$(reply "$out" "set fault 0")" "Error: Fault still active\."
+    check "fault leaves the speed" "$(reply "$out" "get m1duty")" "500"
+    check "fault cleared" "$(reply "$out" "get fault" 2)" "0x0"
+    check "fault clear stops the motor" "$(reply "$out" "get m1duty" 2)" "0"
+    check "bridge back after a fault" "$(reply "$out" "get m1current" 2)" "0xC8"
+fi
+
+# An overcurrent trips after a few samples over the limit, and is
+# cleared at once.
+if variant load; then
+    out=$(PRG=$tmp/load session "set m1limit 0x100" "set m1duty 1023" "sleep 0.3" "get fault" "get m1trips" \
+                                "get m1current" "set fault 0" "get fault" "get m1duty")
+    check "overcurrent latched" "$(reply "$out" "get fault")" "0x4"
+    check "overcurrent counted" "$(reply "$out" "get m1trips")" "0x1"
+    check "overcurrent turns the bridge off" "$(reply "$out" "get m1current")" "0x0"
+    check "overcurrent cleared" "$(reply "$out" "get fault" 2)" "0x0"
+    check "overcurrent clear stops the motor" "$(reply "$out" "get m1duty")" "0"
+fi
+
+# A capture is announced as an event and sent as one block on request,
+# see scope.h. A request while it goes out cuts it short: the part sent
+# fails the crc and the reply follows intact.
+# Sent: set scopebits 10, scopepre 20, scopetrig 4 (level), scopelevel
+# 0x100, scope 1 (arm) and m1duty 800, get scopedata, and get scopedata
+# followed at once by get led1.
+if variant load; then
+    out=$(frames "$(PRG=$tmp/load bsession '\062\012\345' '\065\024\324' '\063\004\332' \
+              '\064\000\001\115' '\057\001\152' '\033\040\003\351' "sleep 0.5" \
+              '\160\127' "sleep 0.3" '\160\127\300\300\105\334' "sleep 0.3")")
+    check "scope event" "$(printf '%s\n' "$out" | grep '^af ' | sed -n 2p)" "af 03 00 30 ok"
+    check "scope block" "$(printf '%s\n' "$out" | grep '^b0 ' | sed -n 1p)" "b0 01 04 80 00 14 00( [0-9a-f]{2}){257} ok"
+    check "scope level trigger" "$(printf '%s\n' "$out" | awk '/^b0 / { print $47, $49; exit }')" "00 0[1-3]"
+    check "scope block cut short" "$(printf '%s\n' "$out" | grep '^b0 ' | sed -n 2p)" "b0( [0-9a-f]{2})* bad"
+    check "reply after a cut block" "$(printf '%s\n' "$out" | sed -n '$p')" "85 0[01] 00 [0-9a-f]{2} ok"
+fi
+
+# The current loop drives the feedback to the setpoint, past the ramp,
+# see torque.h. The load gives two counts per duty count.
+if variant load; then
+    out=$(PRG=$tmp/load session "set pwmfreq 4902" "set m1accel 10" "set m1torque 300" "sleep 0.5" "get m1current")
+    check "torque loop" "$(reply "$out" "get m1current")" "0x12[ABCDE]"
+    out=$(PRG=$tmp/load session "set pwmfreq 153" "set m1torque -200" "sleep 1" "get m1current" "get m1ramp")
+    check "torque loop reverse" "$(reply "$out" "get m1current")" "0xC[6789A]"
+    check "torque loop direction" "$(reply "$out" "get m1ramp")" "-[0-9]+"
+fi
+
+# The duty follows the battery, see setSupply(). 500 is a duty of 125
+# counts at the nominal voltage, the feedback of the load is twice that.
+# At 3/4 of it the duty goes up by 4/3, and without a battery sample up
+# to twice.
+if variant vbat -DVBAT_ADC=0 -DTEMP_ADC=1; then
+    out=$(export LOAD_VBAT=0x300 LOAD_TEMP=0x155; PRG=$tmp/vbat
+          session "get vcomp" "set m1duty 500" "sleep 0.3" "get m1current" "get vbat" "get temp")
+    check "supply nominal" "$(reply "$out" "get vcomp")" "1\.000"
+    check "supply nominal duty" "$(reply "$out" "get m1current")" "0xFA"
+    check "battery sample" "$(reply "$out" "get vbat")" "0x1800"
+    check "temperature sample" "$(reply "$out" "get temp")" "0xAA8"
+    out=$(export LOAD_VBAT=0x240; PRG=$tmp/vbat
+          session "set m1duty 500" "sleep 0.3" "get vcomp" "get m1current")
+    check "supply sagged" "$(reply "$out" "get vcomp")" "1\.333"
+    check "supply sagged duty" "$(reply "$out" "get m1current")" "0x14C"
+    out=$(export LOAD_VBAT=0; PRG=$tmp/vbat
+          session "sleep 0.3" "get vcomp")
+    check "supply missing" "$(reply "$out" "get vcomp")" "2\.000"
+fi
+
+exit $failed
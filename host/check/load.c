@@ -0,0 +1,104 @@
+/* Load model for the checks of the host build, see check.sh.
+ *
+ * Linked into a variant of the host build, it sets the ADC inputs every
+ * millisecond, from a signal handler as hardware would change them behind
+ * the back of the firmware. The current feedback of each motor follows
+ * its duty, two counts per count of timer 0, as a motor stalled on its
+ * sense resistor would, and drops to 0 with the bridge disabled. The rest
+ * is taken from the environment:
+ *
+ * LOAD_FAULT_AT  milliseconds after start at which the fault output of
+ *              bridge 1 goes active, 0 for never.
+ * LOAD_FAULT_FOR milliseconds it stays active, 0 for good.
+ * LOAD_OFFSET  counts added to the feedback of motor 1.
+ * LOAD_DITHER  nonzero adds 1 to every other sample of motor 1, so its
+ *              mean is half a count up. The samples must be more than a
+ *              millisecond apart, as at a PWM frequency of 613 Hz or less.
+ * LOAD_VBAT    raw sample of the battery input VBAT_ADC, if built with it.
+ * LOAD_TEMP    raw sample of the temperature input TEMP_ADC. */
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <avr/io.h>
+#include "config.h"
+#include "adc.h"
+
+extern uint16_t hostAdcInput[32];
+extern uint8_t hostPinLow[4];
+
+static uint32_t loadTime;
+static uint32_t loadFaultAt;
+static uint32_t loadFaultFor;
+static uint16_t loadOffset;
+static uint16_t loadDither;
+static uint16_t loadVbat;
+static uint16_t loadTemp;
+
+static uint16_t loadDutyM1(void) {
+    /* Out of 255, whichever way the motor turns. */
+    if (!(M1_REG & M1_ENABLE)) return 0;
+#if DISABLE_PWM
+    return 0xFF - OCR0A;
+#else
+    return OCR0A + OCR0B;
+#endif /* DISABLE_PWM */
+}
+
+static uint16_t loadDutyM2(void) {
+    /* Out of ICR1, scaled to timer 0. */
+    uint16_t top = ICR1;
+
+    if (!top || !(M2_REG & M2_ENABLE)) return 0;
+#if DISABLE_PWM
+    return (uint32_t)(top - OCR1A) * 0xFF / top;
+#else
+    return (uint32_t)(OCR1A + OCR1B) * 0xFF / top;
+#endif /* DISABLE_PWM */
+}
+
+static void loadTick(int sig) {
+    uint16_t m1;
+
+    /* M1_FAULT is on port A, the first of hostPinLow[]. */
+    loadTime++;
+    if (loadFaultAt && (loadTime == loadFaultAt)) hostPinLow[0] |= M1_FAULT;
+    if (loadFaultAt && loadFaultFor && (loadTime == loadFaultAt + loadFaultFor)) {
+        hostPinLow[0] &= ~M1_FAULT;
+    }
+
+    m1 = loadDutyM1() * 2 + loadOffset;
+
+    /* Counted up by the sample, the next one gets the other value. */
+    if (loadDither) m1 += adcSamples[0] & 1;
+    hostAdcInput[M1_FEEDBACKADC] = m1;
+    hostAdcInput[M2_FEEDBACKADC] = loadDutyM2() * 2;
+#ifdef VBAT_ADC
+    hostAdcInput[VBAT_ADC] = loadVbat;
+#endif /* VBAT_ADC */
+#ifdef TEMP_ADC
+    hostAdcInput[TEMP_ADC] = loadTemp;
+#endif /* TEMP_ADC */
+}
+
+static uint32_t loadEnv(const char *name) {
+    const char *value = getenv(name);
+
+    return value ? strtoul(value, 0, 0) : 0;
+}
+
+static void loadInit(void) __attribute__((constructor));
+static void loadInit(void) {
+    struct itimerval period = { { 0, 1000 }, { 0, 1000 } };
+
+    loadFaultAt = loadEnv("LOAD_FAULT_AT");
+    loadFaultFor = loadEnv("LOAD_FAULT_FOR");
+    loadOffset = loadEnv("LOAD_OFFSET");
+    loadDither = loadEnv("LOAD_DITHER");
+    loadVbat = loadEnv("LOAD_VBAT");
+    loadTemp = loadEnv("LOAD_TEMP");
+    loadTick(0);
+    signal(SIGALRM, loadTick);
+    setitimer(ITIMER_REAL, &period, 0);
+}
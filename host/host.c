@@ -0,0 +1,583 @@
+/* Linux host backend, see hal.h.
+ *
+ * Stands in for the peripherals the firmware uses. Nothing runs
+ * concurrently with the firmware: the peripherals advance, and their
+ * interrupt handlers are called, whenever the firmware enables interrupts,
+ * sleeps or waits in halWait(). */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include "hal.h"
+
+#define HOST_BUF_SIZE       4096
+/* Timer interrupts delivered at most per poll, after a stall the timer
+ * skips ahead rather than flooding the firmware. */
+#define HOST_TIMER_CATCHUP  16
+
+volatile uint8_t hostIo[HOST_IO_SIZE] __attribute__((aligned(2)));
+
+/* Values returned by the ADC, by input channel. Set from a debugger or
+ * a test harness linked against the host build. */
+uint16_t hostAdcInput[32];
+
+/* Input pins pulled low from outside, by port A to D. Other input pins
+ * read high with their pull-up on and low without. */
+uint8_t hostPinLow[4];
+
+/* The handlers of the firmware. Weak, so the ones it lacks stay 0. */
+void USART0_RX_vect(void) __attribute__((weak));
+void USART0_UDRE_vect(void) __attribute__((weak));
+void USART1_RX_vect(void) __attribute__((weak));
+void USART1_UDRE_vect(void) __attribute__((weak));
+void TIMER0_OVF_vect(void) __attribute__((weak));
+void TIMER2_COMPA_vect(void) __attribute__((weak));
+void ADC_vect(void) __attribute__((weak));
+void PCINT0_vect(void) __attribute__((weak));
+void PCINT1_vect(void) __attribute__((weak));
+void PCINT2_vect(void) __attribute__((weak));
+void PCINT3_vect(void) __attribute__((weak));
+
+typedef struct hostUart_ {
+    const char *env;        /* Environment variable selecting the port, HOST_UARTn. */
+    uint8_t status;         /* Addresses of UCSRnA, UCSRnB and UDRn. */
+    uint8_t control;
+    uint8_t data;
+    void (*rxVector)(void);
+    void (*udreVector)(void);
+    int rxFd;
+    int txFd;
+    uint8_t eof;            /* Input used up, stdin only. */
+    uint16_t rxPos;
+    uint16_t rxLen;
+    uint16_t txLen;
+    uint8_t rxBuf[HOST_BUF_SIZE];
+    uint8_t txBuf[HOST_BUF_SIZE];
+} hostUart;
+
+static hostUart hostUarts[2] = {
+    { "HOST_UART0", 0xC0, 0xC1, 0xC6, USART0_RX_vect, USART0_UDRE_vect, -1, -1 },
+    { "HOST_UART1", 0xC8, 0xC9, 0xCE, USART1_RX_vect, USART1_UDRE_vect, -1, -1 },
+};
+
+#define HOST_UARTS  (sizeof(hostUarts) / sizeof(hostUarts[0]))
+
+static uint64_t hostStart;
+static uint64_t hostTimer0Last;
+static uint64_t hostTimer1Last;
+static uint8_t hostTimer1Top;
+static uint8_t hostTimer1Flags;
+static uint64_t hostTimer2Last;
+static uint64_t hostAdcStart;
+static uint8_t hostAdcBusy;
+static uint8_t hostBusy;
+static uint64_t hostWdtLast;
+
+volatile uint8_t hostWdtFed;
+
+/*
+ * Register trace.
+ */
+
+typedef struct hostReg_ {
+    uint8_t addr;
+    const char *name;
+} hostReg;
+
+/* Registers worth tracing. SREG is left out, it changes with every
+ * cli() and sei(). */
+static const hostReg hostRegs[] = {
+    { 0x20, "PINA" }, { 0x21, "DDRA" }, { 0x22, "PORTA" },
+    { 0x23, "PINB" }, { 0x24, "DDRB" }, { 0x25, "PORTB" },
+    { 0x26, "PINC" }, { 0x27, "DDRC" }, { 0x28, "PORTC" },
+    { 0x29, "PIND" }, { 0x2A, "DDRD" }, { 0x2B, "PORTD" },
+    { 0x35, "TIFR0" }, { 0x36, "TIFR1" }, { 0x37, "TIFR2" },
+    { 0x3B, "PCIFR" }, { 0x3C, "EIFR" }, { 0x3D, "EIMSK" },
+    { 0x3F, "EECR" }, { 0x40, "EEDR" }, { 0x41, "EEARL" }, { 0x42, "EEARH" },
+    { 0x43, "GTCCR" }, { 0x44, "TCCR0A" }, { 0x45, "TCCR0B" },
+    { 0x46, "TCNT0" }, { 0x47, "OCR0A" }, { 0x48, "OCR0B" },
+    { 0x53, "SMCR" }, { 0x54, "MCUSR" }, { 0x55, "MCUCR" },
+    { 0x60, "WDTCSR" }, { 0x68, "PCICR" }, { 0x69, "EICRA" },
+    { 0x6B, "PCMSK0" }, { 0x6C, "PCMSK1" }, { 0x6D, "PCMSK2" },
+    { 0x6E, "TIMSK0" }, { 0x6F, "TIMSK1" }, { 0x70, "TIMSK2" }, { 0x73, "PCMSK3" },
+    { 0x78, "ADCL" }, { 0x79, "ADCH" }, { 0x7A, "ADCSRA" }, { 0x7B, "ADCSRB" },
+    { 0x7C, "ADMUX" }, { 0x7E, "DIDR0" }, { 0x7F, "DIDR1" },
+    { 0x80, "TCCR1A" }, { 0x81, "TCCR1B" }, { 0x82, "TCCR1C" },
+    { 0x84, "TCNT1L" }, { 0x85, "TCNT1H" }, { 0x86, "ICR1L" }, { 0x87, "ICR1H" },
+    { 0x88, "OCR1AL" }, { 0x89, "OCR1AH" }, { 0x8A, "OCR1BL" }, { 0x8B, "OCR1BH" },
+    { 0xB0, "TCCR2A" }, { 0xB1, "TCCR2B" }, { 0xB2, "TCNT2" },
+    { 0xB3, "OCR2A" }, { 0xB4, "OCR2B" },
+    { 0xC0, "UCSR0A" }, { 0xC1, "UCSR0B" }, { 0xC2, "UCSR0C" },
+    { 0xC4, "UBRR0L" }, { 0xC5, "UBRR0H" }, { 0xC6, "UDR0" },
+    { 0xC8, "UCSR1A" }, { 0xC9, "UCSR1B" }, { 0xCA, "UCSR1C" },
+    { 0xCC, "UBRR1L" }, { 0xCD, "UBRR1H" }, { 0xCE, "UDR1" },
+};
+
+/* Register contents as last seen, changes made by the host itself go
+ * here as well so only those of the firmware show up. */
+static uint8_t hostShadow[HOST_IO_SIZE];
+static FILE *hostTraceFile;
+
+static uint64_t hostNow(void) {
+    /* Returns monotonic time in nanoseconds. */
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void hostTrace(const char *where) {
+    /* Logs every register the firmware changed since the last call. */
+    unsigned int i;
+    uint64_t us;
+
+    if (!hostTraceFile) return;
+    us = (hostNow() - hostStart) / 1000;
+    for (i = 0; i < sizeof(hostRegs) / sizeof(hostRegs[0]); i++) {
+        uint8_t addr = hostRegs[i].addr;
+        if (hostIo[addr] != hostShadow[addr]) {
+            fprintf(hostTraceFile, "%llu.%06llu %s %s %02x -> %02x\n",
+                    (unsigned long long)(us / 1000000), (unsigned long long)(us % 1000000),
+                    where, hostRegs[i].name, hostShadow[addr], hostIo[addr]);
+            hostShadow[addr] = hostIo[addr];
+        }
+    }
+}
+
+static void hostSet(uint8_t addr, uint8_t value) {
+    /* Changes a register on behalf of the hardware, not traced. */
+    hostIo[addr] = value;
+    hostShadow[addr] = value;
+}
+
+static void hostCall(void (*vector)(void), const char *name) {
+    /* Runs an interrupt handler the way the hardware does. */
+    if (!vector) return;
+    SREG &= ~0x80;
+    vector();
+    SREG |= 0x80;
+    hostTrace(name);
+}
+
+/*
+ * USARTs.
+ */
+
+static void hostUartOpen(hostUart *u, unsigned int port) {
+    /* Connects the port to stdin and stdout, or to a new pseudo terminal. */
+    const char *how = getenv(u->env);
+    struct termios tio;
+    int slave;
+
+    if (how && (strcmp(how, "-") == 0)) {
+        u->rxFd = STDIN_FILENO;
+        u->txFd = STDOUT_FILENO;
+        return;
+    }
+
+    u->rxFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((u->rxFd < 0) || grantpt(u->rxFd) || unlockpt(u->rxFd)) {
+        perror("host: posix_openpt");
+        exit(1);
+    }
+    /* Keep the slave side open, so the port survives terminal programs
+     * coming and going, and make it raw, the firmware does its own line
+     * editing. */
+    slave = open(ptsname(u->rxFd), O_RDWR | O_NOCTTY);
+    if ((slave < 0) || tcgetattr(slave, &tio)) {
+        perror("host: pty");
+        exit(1);
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    fcntl(u->rxFd, F_SETFL, O_NONBLOCK);
+    u->txFd = u->rxFd;
+    fprintf(stderr, "host: uart%u on %s\n", port, ptsname(u->rxFd));
+}
+
+static void hostUartFlush(hostUart *u) {
+    /* Hands transmitted bytes on to the terminal, as far as it takes them. */
+    ssize_t n;
+
+    if (!u->txLen) return;
+    n = write(u->txFd, u->txBuf, u->txLen);
+    if (n <= 0) return;
+    u->txLen -= n;
+    memmove(u->txBuf, u->txBuf + n, u->txLen);
+}
+
+static void hostUartFill(hostUart *u) {
+    /* Reads the input poll() found waiting. */
+    ssize_t n;
+
+    n = read(u->rxFd, u->rxBuf, sizeof(u->rxBuf));
+    if (n > 0) {
+        u->rxPos = 0;
+        u->rxLen = n;
+    } else if ((n == 0) && (u->rxFd == STDIN_FILENO)) {
+        u->eof = 1;
+    }
+}
+
+static void hostUartPoll(hostUart *u) {
+    uint8_t status = hostIo[u->status] & (_BV(U2X0) | _BV(TXC0));
+
+    /* Receive up to and including one line or frame terminator per poll,
+     * the main loop gets to handle the line before the next one comes in.
+     * On the target the baud rate paces the input in much the same way. */
+    if (hostIo[u->control] & _BV(RXCIE0)) {
+        while (u->rxPos < u->rxLen) {
+            uint8_t data = u->rxBuf[u->rxPos++];
+            hostSet(u->data, data);
+            hostSet(u->status, status | _BV(UDRE0) | _BV(RXC0));
+            hostCall(u->rxVector, u->env + 5);
+            if ((data == '\r') || (data == '\n') || (data == 0xC0)) break;
+        }
+        hostSet(u->status, (hostIo[u->status] & ~_BV(RXC0)) | _BV(UDRE0));
+    }
+
+    /* Transmit while the data register empty interrupt is on. A handler
+     * that leaves it on has written a byte, one that turns it off had
+     * nothing left and the transmitter goes idle. */
+    while ((hostIo[u->control] & _BV(UDRIE0)) && (u->txLen < sizeof(u->txBuf))) {
+        hostCall(u->udreVector, u->env + 5);
+        if (hostIo[u->control] & _BV(UDRIE0)) {
+            u->txBuf[u->txLen++] = hostIo[u->data];
+            hostSet(u->status, hostIo[u->status] & ~_BV(TXC0));
+        } else {
+            hostSet(u->status, hostIo[u->status] | _BV(TXC0));
+        }
+    }
+    if (u->txLen >= sizeof(u->txBuf) / 2) {
+        hostUartFlush(u);
+    }
+}
+
+/*
+ * Timer 0, overflow interrupt in phase correct PWM mode.
+ */
+
+static void hostTimer0(uint64_t now) {
+    static const uint16_t prescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+    uint16_t prescaler = prescalers[TCCR0B & 0x07];
+    uint64_t periodNs;
+    uint8_t n = 0;
+
+    if (!prescaler) {
+        hostTimer0Last = now;
+        return;
+    }
+    /* Up to 0xFF and back down, 510 counts. */
+    periodNs = (uint64_t)prescaler * 510 * 1000000000u / F_CPU;
+    while (now - hostTimer0Last >= periodNs) {
+        if (++n > HOST_TIMER_CATCHUP) {
+            hostTimer0Last = now;
+            break;
+        }
+        hostTimer0Last += periodNs;
+        if (TIMSK0 & _BV(TOIE0)) {
+            hostSet(0x35, TIFR0 & ~_BV(TOV0));
+            hostCall(TIMER0_OVF_vect, "TIMER0_OVF");
+        } else {
+            hostSet(0x35, TIFR0 | _BV(TOV0));
+        }
+    }
+}
+
+/*
+ * Timer 1, flags in phase correct PWM mode with ICR1 as TOP, and the ADC
+ * auto trigger they drive.
+ */
+
+static void hostAdcTrigger(uint8_t source) {
+    /* Starts a conversion if source is the ADTS auto trigger selected. */
+    if ((ADCSRA & _BV(ADEN)) && (ADCSRA & _BV(ADATE)) && !(ADCSRA & _BV(ADSC))
+        && ((ADCSRB & 0x07) == source)) {
+        hostSet(0x7A, ADCSRA | _BV(ADSC));
+    }
+}
+
+static void hostTimer1Flag(uint8_t flag, uint8_t source) {
+    /* The trigger is the rising edge of the flag, it must have been cleared. */
+    if (hostTimer1Flags & flag) return;
+    hostTimer1Flags |= flag;
+    hostAdcTrigger(source);
+}
+
+static void hostTimer1(uint64_t now) {
+    static const uint16_t prescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+    uint16_t prescaler = prescalers[TCCR1B & 0x07];
+    uint64_t halfNs;
+    uint8_t n = 0;
+
+    /* A flag is cleared by writing a one to it. TIFR1 is kept at zero so
+     * the writes show, the flags are in hostTimer1Flags. */
+    if (TIFR1) {
+        hostTimer1Flags &= ~TIFR1;
+        hostSet(0x36, 0);
+    }
+    if (!prescaler || !ICR1) {
+        hostTimer1Last = now;
+        hostTimer1Top = 0;
+        return;
+    }
+    /* Up to ICR1 and back down, TOP and BOTTOM half a period apart. */
+    halfNs = (uint64_t)prescaler * ICR1 * 1000000000u / F_CPU;
+    while (now - hostTimer1Last >= halfNs) {
+        if (++n > HOST_TIMER_CATCHUP) {
+            hostTimer1Last = now;
+            break;
+        }
+        hostTimer1Last += halfNs;
+        hostTimer1Top = !hostTimer1Top;
+        if (hostTimer1Top) {
+            hostTimer1Flag(_BV(ICF1), 7);  /* Capture event */
+        } else {
+            hostTimer1Flag(_BV(TOV1), 6);  /* Overflow */
+        }
+    }
+}
+
+/*
+ * Timer 2, compare match interrupt in CTC mode.
+ */
+
+static void hostTimer2(uint64_t now) {
+    static const uint16_t prescalers[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+    uint16_t prescaler = prescalers[TCCR2B & 0x07];
+    uint64_t countNs;
+    uint64_t periodNs;
+    uint8_t n = 0;
+
+    if (!prescaler) {
+        hostTimer2Last = now;
+        return;
+    }
+    countNs = (uint64_t)prescaler * 1000000000u / F_CPU;
+    periodNs = countNs * (OCR2A + 1);
+    while (now - hostTimer2Last >= periodNs) {
+        if (++n > HOST_TIMER_CATCHUP) {
+            hostTimer2Last = now;
+            break;
+        }
+        hostTimer2Last += periodNs;
+        if (TIMSK2 & _BV(OCIE2A)) {
+            hostSet(0x37, TIFR2 & ~_BV(OCF2A));
+            hostCall(TIMER2_COMPA_vect, "TIMER2_COMPA");
+        } else {
+            hostSet(0x37, TIFR2 | _BV(OCF2A));
+        }
+    }
+    hostSet(0xB2, (now - hostTimer2Last) / countNs);
+}
+
+/*
+ * ADC, conversions started with ADSC, or by the auto trigger.
+ */
+
+static void hostAdc(uint64_t now) {
+    uint8_t prescaler;
+    uint16_t value;
+
+    if (!(ADCSRA & _BV(ADEN)) || !(ADCSRA & _BV(ADSC))) {
+        hostAdcBusy = 0;
+        return;
+    }
+    if (!hostAdcBusy) {
+        hostAdcBusy = 1;
+        hostAdcStart = now;
+    }
+    /* A conversion takes 13 ADC clocks, ADPS0 to ADPS2 select the clock. */
+    prescaler = (ADCSRA & 0x07) ? (1 << (ADCSRA & 0x07)) : 2;
+    if (now - hostAdcStart < 13ull * prescaler * 1000000000u / F_CPU) return;
+
+    hostAdcBusy = 0;
+    value = hostAdcInput[ADMUX & 0x1F] & 0x3FF;
+    if (ADMUX & _BV(ADLAR)) value <<= 6;
+    hostSet(0x78, value & 0xFF);
+    hostSet(0x79, value >> 8);
+    hostSet(0x7A, (ADCSRA & ~_BV(ADSC)) | _BV(ADIF));
+    if (ADCSRA & _BV(ADIE)) {
+        hostSet(0x7A, ADCSRA & ~_BV(ADIF));
+        hostCall(ADC_vect, "ADC");
+    }
+}
+
+/*
+ * Pins and pin change interrupts.
+ */
+
+static void hostPins(void) {
+    static const uint8_t masks[4] = { 0x6B, 0x6C, 0x6D, 0x73 };   /* PCMSK0 to 3 */
+    static void (* const vectors[4])(void) = { PCINT0_vect, PCINT1_vect, PCINT2_vect, PCINT3_vect };
+    static const char * const names[4] = { "PCINT0", "PCINT1", "PCINT2", "PCINT3" };
+    uint8_t port;
+
+    for (port = 0; port < 4; port++) {
+        uint8_t pinAddr = 0x20 + 3 * port;
+        uint8_t ddr = hostIo[pinAddr + 1];
+        uint8_t out = hostIo[pinAddr + 2];
+        uint8_t level = (out & ddr) | (out & ~ddr & ~hostPinLow[port]);
+        uint8_t changed = level ^ hostIo[pinAddr];
+
+        hostSet(pinAddr, level);
+        if (changed & hostIo[masks[port]]) {
+            hostSet(0x3B, PCIFR | _BV(port));
+            if (PCICR & _BV(port)) {
+                hostSet(0x3B, PCIFR & ~_BV(port));
+                hostCall(vectors[port], names[port]);
+            }
+        }
+    }
+}
+
+/*
+ * Watchdog, system reset mode only.
+ */
+
+void hostWdtEnable(uint8_t value) {
+    uint8_t wdtcsr = _BV(WDE) | (value & 0x07);
+
+    if (value & 0x08) wdtcsr |= _BV(WDP3);
+    WDTCSR = wdtcsr;
+    hostWdtFed = 1;
+}
+
+static void hostWdt(uint64_t now) {
+    uint8_t prescaler = (WDTCSR & 0x07) | ((WDTCSR & _BV(WDP3)) ? 0x08 : 0);
+
+    if (hostWdtFed || !(WDTCSR & _BV(WDE))) {
+        hostWdtFed = 0;
+        hostWdtLast = now;
+        return;
+    }
+    /* 2048 cycles of the 128 kHz oscillator at WDTO_15MS, doubling with
+     * every step. */
+    if (now - hostWdtLast > (16000000ull << prescaler)) {
+        fprintf(stderr, "host: watchdog reset\n");
+        exit(2);
+    }
+}
+
+/*
+ * Entry points.
+ */
+
+static void hostExitIfDone(void) {
+    /* Ends a run on stdin once all input is handled and sent back.
+     * Only called when the firmware sleeps, so no line is left pending. */
+    unsigned int i;
+
+    for (i = 0; i < HOST_UARTS; i++) {
+        hostUart *u = &hostUarts[i];
+        if (u->eof && (u->rxPos == u->rxLen) && !(hostIo[u->control] & _BV(UDRIE0))) {
+            while (u->txLen) {
+                hostUartFlush(u);
+            }
+            exit(0);
+        }
+    }
+}
+
+void hostPoll(void) {
+    uint64_t now;
+    unsigned int i;
+
+    if (!(SREG & 0x80) || hostBusy) return;
+    hostBusy = 1;
+    hostTrace("main");
+    now = hostNow();
+    hostWdt(now);
+    hostPins();
+    hostTimer0(now);
+    hostTimer1(now);
+    hostTimer2(now);
+    hostAdc(now);
+    for (i = 0; i < HOST_UARTS; i++) {
+        hostUartPoll(&hostUarts[i]);
+    }
+    hostBusy = 0;
+}
+
+void hostSei(void) {
+    SREG |= 0x80;
+    hostPoll();
+}
+
+void hostSleep(void) {
+    struct pollfd fds[2 * HOST_UARTS];
+    int rxSlot[HOST_UARTS];
+    unsigned int count = 0;
+    unsigned int i;
+
+    hostPoll();
+    hostExitIfDone();
+
+    /* Sleep until input arrives, output can go out, or a millisecond
+     * passed, the tick is the slowest interrupt that needs delivering. */
+    for (i = 0; i < HOST_UARTS; i++) {
+        hostUart *u = &hostUarts[i];
+        hostUartFlush(u);
+        rxSlot[i] = -1;
+        if ((u->rxPos == u->rxLen) && !u->eof) {
+            rxSlot[i] = count;
+            fds[count].fd = u->rxFd;
+            fds[count++].events = POLLIN;
+        }
+        if (u->txLen) {
+            fds[count].fd = u->txFd;
+            fds[count++].events = POLLOUT;
+        }
+    }
+    if ((poll(fds, count, 1) < 0) && (errno != EINTR)) {
+        perror("host: poll");
+        exit(1);
+    }
+    for (i = 0; i < HOST_UARTS; i++) {
+        if ((rxSlot[i] >= 0) && (fds[rxSlot[i]].revents & (POLLIN | POLLHUP))) {
+            hostUartFill(&hostUarts[i]);
+        }
+    }
+    hostPoll();
+}
+
+__attribute__((constructor(101)))
+static void hostInit(void) {
+    /* Reset state of the registers and set up the ports, runs before main()
+     * and the constructors standing in for the .init sections. */
+    const char *trace = getenv("HOST_TRACE");
+    unsigned int i;
+
+    hostStart = hostNow();
+    hostTimer0Last = hostStart;
+    hostTimer1Last = hostStart;
+    hostTimer2Last = hostStart;
+    hostSet(0x54, _BV(PORF));                       /* MCUSR, power-on */
+    hostSet(0xC0, _BV(UDRE0));                      /* UCSR0A */
+    hostSet(0xC2, _BV(UCSZ01) | _BV(UCSZ00));       /* UCSR0C */
+    hostSet(0xC8, _BV(UDRE1));                      /* UCSR1A */
+    hostSet(0xCA, _BV(UCSZ11) | _BV(UCSZ10));       /* UCSR1C */
+
+    if (trace) {
+        hostTraceFile = fopen(trace, "w");
+        if (!hostTraceFile) {
+            perror(trace);
+            exit(1);
+        }
+        setvbuf(hostTraceFile, 0, _IOLBF, 0);
+    }
+    for (i = 0; i < HOST_UARTS; i++) {
+        hostUartOpen(&hostUarts[i], i);
+    }
+}
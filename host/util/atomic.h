@@ -0,0 +1,29 @@
+#ifndef HOST_UTIL_ATOMIC_H_
+#define HOST_UTIL_ATOMIC_H_
+
+/* Host stand-in for <util/atomic.h>, see hal.h. Same scheme as avr-libc,
+ * the I bit is restored by a cleanup handler when the block is left. */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+static inline void hostAtomicRestore(const uint8_t *sreg) {
+    SREG = *sreg;
+}
+
+static inline void hostAtomicForceOn(const uint8_t *sreg) {
+    (void)sreg;
+    sei();
+}
+
+static inline uint8_t hostAtomicCli(void) {
+    cli();
+    return 1;
+}
+
+#define ATOMIC_BLOCK(type)  for (type, hostAtomicToDo = hostAtomicCli(); hostAtomicToDo; hostAtomicToDo = 0)
+
+#define ATOMIC_RESTORESTATE uint8_t hostAtomicSreg __attribute__((__cleanup__(hostAtomicRestore))) = SREG
+#define ATOMIC_FORCEON      uint8_t hostAtomicSreg __attribute__((__cleanup__(hostAtomicForceOn))) = 0
+
+#endif /* HOST_UTIL_ATOMIC_H_ */
@@ -0,0 +1,21 @@
+#ifndef HOST_UTIL_CRC16_H_
+#define HOST_UTIL_CRC16_H_
+
+/* Host stand-in for <util/crc16.h>, see hal.h. */
+
+static inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data) {
+    /* Polynomial x^8 + x^2 + x + 1, same results as the avr-libc version. */
+    uint8_t i;
+
+    crc ^= data;
+    for (i = 0; i < 8; i++) {
+        if (crc & 0x80) {
+            crc = (crc << 1) ^ 0x07;
+        } else {
+            crc <<= 1;
+        }
+    }
+    return crc;
+}
+
+#endif /* HOST_UTIL_CRC16_H_ */
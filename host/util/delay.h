@@ -0,0 +1,12 @@
+#ifndef HOST_UTIL_DELAY_H_
+#define HOST_UTIL_DELAY_H_
+
+/* Host stand-in for <util/delay.h>, see hal.h. The host is fast enough
+ * for any delay to have passed, the peripherals just catch up. */
+
+void hostPoll(void);
+
+#define _delay_us(us)   hostPoll()
+#define _delay_ms(ms)   hostPoll()
+
+#endif /* HOST_UTIL_DELAY_H_ */
@@ -1,12 +1,20 @@
-#include <stdio.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
-#include "uart.h"
+#include <avr/sleep.h>
+#include <avr/wdt.h>
 #include "config.h"
+#include "uart.h"
 #include "motor.h"
+#include "astring.h"
 #include "cmd.h"
 #include "adc.h"
+#include "proto.h"
+#include "tick.h"
+#include "prop.h"
+#include "fault.h"
+#include "failsafe.h"
+#include "scope.h"
 
 static void initRegisters(void) {
     /* Setup Leds as outputs. */
@@ -18,77 +26,70 @@ static void initRegisters(void) {
 }
 
 
-uint8_t uartWorker(uint16_t getChar, uint8_t localEcho) {
-    uint16_t character = getChar;
-    if (character & UART_NO_DATA) {
-        /* Nothing to see here. */
-        return 0;
-    } else {
-        /* Data! */
-        if (localEcho) {
-            uart1_putc((uint8_t)character); /* Loopback */
-            if((uint8_t)character == '\r') uart1_putc('\n'); /* New line if return. */
-        }
-        return (uint8_t)character;
-    }
-}
-
-typedef struct cmdBuffer_ {
-    uint8_t buffer[127];
-    uint8_t length;
-    uint8_t head;
-} cmdBuffer;
-
-const cmdBuffer CMD_BUFFER_DEFAULTS = { "", 128, 0 };
-
-void uartParser(uint8_t uartChar, cmdBuffer *buf) {
-    if((uartChar == '\n') || (uartChar == '\r')) { 
-        /* Set null terminator for detection of end of string. */
-        buf->buffer[buf->head] = '\0';
-        /* Go to beginning of buffer. */
-        buf->head = 0;
-        /* Process command. */
-        cmdParser(buf->buffer);
-        /* uart_puts_P("# "); */
-    } else if ((buf->head < buf->length) && ((uartChar > 0x1F) && (uartChar < 0x7F))){
-        /* Buffer is not full and character is valid.
-         * Put character in buffer. */
-        buf->buffer[buf->head] = uartChar;
-        buf->head++;
-    }
-}
-
 int main(void)
 {
+    initWatchdog();
     initRegisters();
     initPwm();
+    initTick();
 
-    /* UART0 connected to FT312. */
-    uart_init((UART_BAUD_SELECT((SERIAL_BAUDRATE), F_CPU)));
-    cmdBuffer uart0Buffer = CMD_BUFFER_DEFAULTS;
-    uint8_t uartChar;    
+    /* UART0 connected to FT312. The rate is picked at run time as it can
+     * be changed later on, double speed mode gets 57600 closer at 20MHz. */
+    uart_init(UART_PORT0, uart_baudselect(SERIAL_BAUDRATE));
     /* UART1 connected to FT230. */
-    uart1_init((UART_BAUD_SELECT((SERIAL_BAUDRATE), F_CPU)));
-    cmdBuffer uart1Buffer = CMD_BUFFER_DEFAULTS;
-    uint8_t uart1Char;
+    uart_init(UART_PORT1, uart_baudselect(SERIAL_BAUDRATE));
+    cmdSetMode(&cmdSessions[CMD_SESSION_UART0], PROTO_MODE_ASCII);
+    cmdSetMode(&cmdSessions[CMD_SESSION_UART1], PROTO_MODE_ASCII);
+    /* Never let the main loop wait for a serial line. Binary replies are
+     * all or nothing, console text is rather cut short. */
+    uart_settxpolicy(UART_PORT0, UART_TX_DROP);
+    uart_settxpolicy(UART_PORT1, UART_TX_TRUNCATE);
+    uint8_t i;
+
+    set_sleep_mode(SLEEP_MODE_IDLE);
     
     sei(); /* Enable interrupts. */
 
     initAdc();
-    uart1_puts_P("Welcome to the Robot of Awesome Controller terminal\r\n");
-    uart1_puts_P("# ");
+    uart_puts_P(UART_PORT1, "Welcome to the Robot of Awesome Controller terminal\r\n");
+    uart_puts_P(UART_PORT1, "# ");
     LEDREG |= LED1;
     
     setEnableM1(1);
     setEnableM2(1);
+    initFault();
 
 
     while(1)
     {
-        uartChar = uartWorker(uart_getc(), 0);
-        uartParser(uartChar, &uart0Buffer);
-        uart1Char = uartWorker(uart1_getc(), 1);
-        uartParser(uart1Char, &uart1Buffer);
+        /* Lines are assembled by the receive interrupts,
+         * only complete commands show up here. Each session replies
+         * on its own port. */
+        for (i = 0; i < CMD_SESSION_COUNT; i++) {
+            cmdPoll(&cmdSessions[i]);
+        }
+
+        /* The bridge is off already, tell everyone why. */
+        if (faultPoll()) cmdEvent(PROP_FAULT);
+        /* A capture is done, the host fetches it with a GET of scopedata. */
+        if (scopePoll()) cmdEvent(PROP_SCOPE);
+        failsafePoll();
+#ifdef VBAT_ADC
+        if (adcPoll() & (1<<ADC_SLOT_VBAT)) setSupply(adcGetSlot(ADC_SLOT_VBAT));
+#endif /* VBAT_ADC */
+        wdt_reset();
 
+        /* Idle until the next interrupt if nothing is waiting. The tick
+         * wakes the loop every millisecond to run timeouts.
+         * Checking with interrupts disabled makes sure a line completed
+         * meanwhile is not slept on, sei() takes effect after sleep_cpu(). */
+        cli();
+        if (!uart_available(UART_PORT0) && !uart_available(UART_PORT1)) {
+            sleep_enable();
+            sei();
+            sleep_cpu();
+            sleep_disable();
+        }
+        sei();
     }
 }
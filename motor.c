@@ -1,7 +1,142 @@
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+#include <util/atomic.h>
 #include "motor.h"
+#include "adc.h"
 #include "config.h"
 
+#define MOTOR_CS0_MASK  ((1<<CS02) | (1<<CS01) | (1<<CS00))
+#define MOTOR_CS1_MASK  ((1<<CS12) | (1<<CS11) | (1<<CS10))
+
+/* PWM frequencies. Timer 0 runs 8-bit phase correct PWM, 2*255 counts per
+ * period, so its prescaler sets the frequency. Timer 1 gets the prescaler
+ * and TOP (ICR1) giving the same period with the finest resolution.
+ * Clock selection ref p. 107 and p. 135. */
+typedef struct motorPwm_ {
+    uint16_t freq;  /* Hz, rounded. */
+    uint8_t clock0; /* CS0x bits of TCCR0B. */
+    uint8_t clock1; /* CS1x bits of TCCR1B. */
+    uint16_t top;   /* ICR1. */
+} motorPwm;
+
+static const motorPwm motorPwmTable[] PROGMEM = {
+    /* 20MHz / (2*255*1024) = 2 * 1020 * 256 */
+    { 38, (1<<CS02) | (1<<CS00), (1<<CS12), 1020 },
+    /* /256, a somewhat pleasant motor sound. */
+    { 153, (1<<CS02), (1<<CS11) | (1<<CS10), 1020 },
+    { 613, (1<<CS01) | (1<<CS00), (1<<CS11), 2040 },
+    { 4902, (1<<CS01), (1<<CS10), 2040 },
+    /* Inaudible, timer 1 is down to timer 0 resolution. 20 kHz is out of
+     * reach, timer 0 would need OCR0A as TOP and OC0A carries M1. */
+    { 39216, (1<<CS00), (1<<CS10), 255 },
+};
+
+#define MOTOR_PWM_COUNT (sizeof(motorPwmTable) / sizeof(motorPwmTable[0]))
+
+/* Largest ratio between a requested frequency and the entry used, 1.25
+ * in 1/256. The entries are 4 to 8 times apart. */
+#define MOTOR_PWM_TOLERANCE 320
+
+/* Selected entry of motorPwmTable[], kept over resets. */
+static uint8_t motorPwmSaved EEMEM = MOTOR_PWM_DEFAULT;
+static uint8_t motorPwmIndex;
+
+static uint16_t motorM2Top = 1020;
+
+/* Setpoints are staged here and committed to the registers of both motors
+ * together by the timer 0 overflow interrupt, see motorCommit(). */
+typedef struct motorSetpoint_ {
+    int16_t speed;      /* As set, after clamping. */
+    uint16_t duty;      /* Compare counts for speed. */
+    int8_t dir;         /* Sign of speed. */
+    int8_t appliedDir;  /* Direction in the registers. */
+    uint8_t direct;     /* Not supply compensated, see setSpeedDirect(). */
+} motorSetpoint;
+
+static motorSetpoint motorSetpoints[2];
+static volatile uint8_t motorPending; /* Bit 0 for M1, bit 1 for M2. */
+
+/* The speeds set are targets, the ramp walks the staged speed toward them
+ * every millisecond, see motorRamp(). */
+typedef struct motorRampState_ {
+    int16_t target;     /* As set, after clamping. */
+    int32_t pos;        /* Ramp output, in 1/256 speed units. */
+    uint16_t accel;     /* Speed units per second, 0 is unlimited. */
+    uint16_t decel;
+    uint16_t accelStep; /* 1/256 speed units per millisecond. */
+    uint16_t decelStep;
+} motorRampState;
+
+static motorRampState motorRamps[2];
+
+/* Duty scale of the supply compensation, see setSupply(). */
+#define MOTOR_SUPPLY_SHIFT  10
+#define MOTOR_SUPPLY_ONE    (1 << MOTOR_SUPPLY_SHIFT)
+static uint16_t motorSupplyScale = MOTOR_SUPPLY_ONE;
+
+static void motorApplyM1(int8_t dir, uint8_t duty);
+static void motorApplyM2(int8_t dir, uint16_t duty);
+static void motorStage(uint8_t motor, int16_t speed);
+
+static inline void motorCommit(uint8_t motor) __attribute__((always_inline));
+static inline void motorCommit(uint8_t motor) {
+    /* Writes a staged setpoint to the registers. */
+    motorSetpoint *setpoint = &motorSetpoints[motor];
+    int8_t dir = setpoint->dir;
+
+#if DISABLE_PWM
+    /* A reversal first turns the bridge off for one period, so the
+     * direction pins never change while it drives. */
+    if (dir && setpoint->appliedDir && (dir != setpoint->appliedDir)) dir = 0;
+#endif /* DISABLE_PWM */
+
+    if (motor == 0) {
+        motorApplyM1(dir, setpoint->duty);
+    } else {
+        motorApplyM2(dir, setpoint->duty);
+    }
+    setpoint->appliedDir = dir;
+    if (dir == setpoint->dir) motorPending &= ~(1<<motor);
+}
+
+static void motorStart(void) {
+    /* Commits at the next overflow. The flag has been set at every
+     * overflow since the interrupt was last on, clear it first. */
+    if (!(TIMSK0 & (1<<TOIE0))) {
+        TIFR0 = (1<<TOV0);
+        TIMSK0 |= (1<<TOIE0);
+    }
+}
+
+static void motorSetPwm(uint8_t index) {
+    /* Reprograms both timers for a table entry and restarts them in step. */
+    motorPwm entry;
+
+    memcpy_P(&entry, &motorPwmTable[index], sizeof(entry));
+    motorPwmIndex = index;
+
+    /* Hold the prescaler shared by timer 0 and 1 while they are changed. */
+    GTCCR = (1<<TSM) | (1<<PSRSYNC);
+    TCCR0B = (TCCR0B & ~MOTOR_CS0_MASK) | entry.clock0;
+    TCCR1B = (TCCR1B & ~MOTOR_CS1_MASK) | entry.clock1;
+    TCNT0 = 0;
+    /* The compare values depend on TOP. The speeds stay the same, so they
+     * are committed right away. The overflow interrupt writes OCR1A/B,
+     * which share the high byte latch with TCNT1 and ICR1. */
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TCNT1 = 0;
+        ICR1 = entry.top;
+        motorM2Top = entry.top;
+        motorStage(0, motorSetpoints[0].speed);
+        motorStage(1, motorSetpoints[1].speed);
+        if (motorPending & 0x01) motorCommit(0);
+        if (motorPending & 0x02) motorCommit(1);
+    }
+    GTCCR = 0;
+}
+
 void initPwm(void) {
     /* Setups the timers for PWM.
      * The different PWMs are enabled through:
@@ -17,79 +152,112 @@ void initPwm(void) {
      * OCR1B for OC1B (M2_IN2)
      *
      * Note that the default duty cycle is 0%. */
+    uint8_t pwm;
 
     /* Init timer 0 assoicated with OC0A/B. */
     /* Mode 1 - Phase Correct PWM. */
     TCCR0A |= (1<<WGM00);
-    /* Prescaler selection.
-     * Our frequency is 20MHz.
-     * A prescaler of /256 gives a somewhat pleasant motor sound.
-     * Clock selection ref p. 107 */
-    TCCR0B |= (1<<CS02);
 
     /* Init Timer 1 associated with OC1A/B.
-     * Same settings apply, even if timer 1 is a 16-bit timer.
-     * Mode 1 - PWM, Phase Correct, 8-bit. */
-    TCCR1A |= (1<<WGM10);
-    /* Analogous to the timer 0 case, we set a prescaler of 1024.
-     * Thus, CS10=CS12=1. */
-    TCCR1B |= (1<<CS12);
+     * Timer 1 is a 16-bit timer, so it gets a finer resolution:
+     * Mode 10 - PWM, Phase Correct, TOP = ICR1. */
+    TCCR1A |= (1<<WGM11);
+    TCCR1B |= (1<<WGM13);
+
+    /* Prescalers, see motorPwmTable. An erased EEPROM reads 0xFF. */
+    pwm = eeprom_read_byte(&motorPwmSaved);
+    motorSetPwm((pwm < MOTOR_PWM_COUNT) ? pwm : MOTOR_PWM_DEFAULT);
+
+    setAccel(1, MOTOR_ACCEL_DEFAULT);
+    setAccel(2, MOTOR_ACCEL_DEFAULT);
+    setDecel(1, MOTOR_DECEL_DEFAULT);
+    setDecel(2, MOTOR_DECEL_DEFAULT);
     
     /* Set PWM ports as outputs. */
     M1_PWMDDR |= M1_PWMDDRBITS;
     M2_PWMDDR |= M2_PWMDDRBITS;
-
-#if DISABLE_PWM
-        /* The motor should be disabled at start. */
-        M1_PWM_DC = 0xFF;
-        M2_PWM_DC = 0xFF;
-#endif /* DISABLE_PWM */
 } 
 
-void setSpeedM1(int8_t speed) {
-    /* Function to set the speed and direction of M1.
-     * Positive speed => Forward.
-     * Negative speed => Reverse. 
-     *
-     * Note that the function maps the value ranges
-     * 1:1:127 => 2:2:254
-     * -1:1:-128 => 1:2:255
-     * due to how the int8_t is represented. */
+uint16_t getPwmFreq(void) {
+    return pgm_read_word(&motorPwmTable[motorPwmIndex].freq);
+}
+
+uint8_t setPwmFreq(uint16_t freq) {
+    /* Picks the frequency closest by ratio. */
+    uint32_t best = UINT32_MAX;
+    uint8_t index = 0;
+    uint8_t i;
+
+    for (i = 0; i < MOTOR_PWM_COUNT; i++) {
+        uint16_t option = pgm_read_word(&motorPwmTable[i].freq);
+        uint32_t ratio = (freq > option) ? ((uint32_t)freq << 8) / option
+                                         : ((uint32_t)option << 8) / freq;
+        if (ratio < best) {
+            best = ratio;
+            index = i;
+        }
+    }
+    if (best > MOTOR_PWM_TOLERANCE) return 0;
+    if (index != motorPwmIndex) {
+        motorSetPwm(index);
+        eeprom_update_byte(&motorPwmSaved, index);
+    }
+    return 1;
+}
+
+static int16_t motorClamp(int16_t speed) {
+    if (speed > MOTOR_SPEED_MAX) return MOTOR_SPEED_MAX;
+    if (speed < -MOTOR_SPEED_MAX) return -MOTOR_SPEED_MAX;
+    return speed;
+}
+
+static uint16_t motorDuty(int16_t speed, uint16_t top) {
+    /* Scales the magnitude of a speed to compare counts, rounded to
+     * nearest, so both directions and both timers map alike. */
+    uint16_t magnitude = (speed < 0) ? -speed : speed;
+    return ((uint32_t)magnitude * top + MOTOR_SPEED_MAX / 2) / MOTOR_SPEED_MAX;
+}
 
-    if (speed > 0) {
+static void motorApplyM1(int8_t dir, uint8_t duty) {
+    /* Sets the direction and duty cycle of M1.
+     * Positive dir => Forward.
+     * Negative dir => Reverse. 
+     *
+     * Timer 0 is an 8-bit timer, the duty is 0:1:255. */
+    if (dir > 0) {
         /* Forward. */
 
 #if DISABLE_PWM
         /* Set M1_IN1 high, M1_IN2 low. */
         M1_REG |= M1_IN1;
         M1_PWMREG &= ~(M1_IN2);
-        M1_PWM_DC = (0xFF - (speed<<1));
+        M1_PWM_DC = MOTOR_M1_TOP - duty;
 #else
         /* Set M1_IN1 to prefered duty cycle.
          * Set M1_IN2 to 0. */
-        M1_IN1_DC = (speed<<1); /* Limit values 2:2:254*/
+        M1_IN1_DC = duty;
         M1_IN2_DC = 0x00;
 #endif /* DISABLE_PWM */
 
-    } else if (speed < 0) {
+    } else if (dir < 0) {
         /* Reverse. */
 #if DISABLE_PWM
         /* Set M1_IN2 high, M1_IN1 low. */
         M1_REG &= ~(M1_IN1);
         M1_PWMREG |= M1_IN2;
-        M1_PWM_DC = (0xFF - (((-speed)<<1)-1)); /* Limit values 1:2:255 */
+        M1_PWM_DC = MOTOR_M1_TOP - duty;
 #else
         /* Set M1_IN1 to 0.
          * Set M1_IN2 to prefered duty cycle. */
         M1_IN1_DC = 0x00;
-        M1_IN2_DC = (((-speed)<<1)-1); /* Limit values 1:2:255 */
+        M1_IN2_DC = duty;
 #endif /* DISABLE_PWM */
 
     } else {
-        /* We're either at a speed of zero or out of bounds. */
+        /* We're at a speed of zero. */
 #if DISABLE_PWM
         /* Simply disable the motor all of the time. */
-        M1_PWM_DC = 0xFF;
+        M1_PWM_DC = MOTOR_M1_TOP;
 #else
         /* Set M1_IN1 and M1_IN2 to zero. */
         M1_IN1_DC = 0x00;
@@ -99,47 +267,43 @@ void setSpeedM1(int8_t speed) {
     }
 }
 
-void setSpeedM2(int8_t speed) {
-    /* Function to set the speed and direction of M2 (rotated motor).
-     * Positive speed => Forward.
-     * Negative speed => Reverse. 
+static void motorApplyM2(int8_t dir, uint16_t duty) {
+    /* Sets the direction and duty cycle of M2 (rotated motor).
+     * Positive dir => Forward.
+     * Negative dir => Reverse. 
      *
-     * Note that the function maps the value ranges
-     * 1:1:127 => 2:2:254
-     * -1:1:-128 => 1:2:255
-     * due to how the int8_t is represented. */
-
-    if (speed < 0) {
+     * Timer 1 runs up to ICR1, the duty is 0:1:ICR1. */
+    if (dir < 0) {
         /* Forward. */
 #if DISABLE_PWM
         /* Set M1_IN2 high, M1_IN1 low. */
         M2_REG |= M2_IN1;
         M2_PWMREG &= ~(M2_IN2);
-        M2_PWM_DC = (0xFF-((-speed)<<1)-1); /* Limit values 1:2:255 */
+        M2_PWM_DC = motorM2Top - duty;
 #else
         /* Set M2_IN1 to prefered duty cycle.
          * Set M2_IN2 to 0. */
-        M2_IN1_DC = (((-speed)<<1)-1); /* Limit values 1:2:255 */
+        M2_IN1_DC = duty;
         M2_IN2_DC = 0x00;
 #endif /* DISABLE_PWM */
-    } else if (speed > 0) {
+    } else if (dir > 0) {
         /* Reverse. */
 #if DISABLE_PWM
         /* Set M1_IN1 high, M1_IN2 low. */
         M2_REG &= ~(M2_IN1);
         M2_PWMREG |= M2_IN2;
-        M2_PWM_DC = (0xFF-(speed<<1));
+        M2_PWM_DC = motorM2Top - duty;
 #else
         /* Set M2_IN1 to 0.
          * Set M2_IN2 to prefered duty cycle. */
-        M2_IN2_DC = (speed<<1); /* Limit values 2:2:254*/
+        M2_IN2_DC = duty;
         M2_IN1_DC = 0x00;
 #endif /* DISABLE_PWM */
     } else {
-        /* We're either at a speed of zero or out of bounds. */
+        /* We're at a speed of zero. */
 #if DISABLE_PWM
         /* Simply disable the motor all of the time. */
-        M2_PWM_DC = 0xFF;
+        M2_PWM_DC = motorM2Top;
 #else
         /* Set M2_IN1 and M2_IN2 to zero. */
         M2_IN1_DC = 0x00;
@@ -148,6 +312,222 @@ void setSpeedM2(int8_t speed) {
     }
 }
 
+static void motorStage(uint8_t motor, int16_t speed) {
+    /* Call with interrupts off. */
+    motorSetpoint *setpoint = &motorSetpoints[motor];
+
+    uint16_t top = motor ? motorM2Top : MOTOR_M1_TOP;
+    uint16_t scale = setpoint->direct ? MOTOR_SUPPLY_ONE : motorSupplyScale;
+    uint32_t duty;
+
+    speed = motorClamp(speed);
+    duty = ((uint32_t)motorDuty(speed, top) * scale) >> MOTOR_SUPPLY_SHIFT;
+    setpoint->speed = speed;
+    setpoint->duty = (duty > top) ? top : duty;
+    setpoint->dir = (speed > 0) - (speed < 0);
+    motorPending |= (1<<motor);
+}
+
+static uint16_t motorRampStep(uint16_t rate) {
+    /* Per second to per millisecond in 1/256 units, at least 1. */
+    uint16_t step = ((uint32_t)rate * 256 + 500) / 1000;
+    return (rate && !step) ? 1 : step;
+}
+
+static uint8_t motorRampMove(uint8_t motor) {
+    /* Moves the ramp output one step toward the target and stages it if
+     * the speed changed. Call with interrupts off.
+     * Returns nonzero if it staged. */
+    motorRampState *ramp = &motorRamps[motor];
+    int32_t target = (int32_t)ramp->target * 256;
+    int32_t pos = ramp->pos;
+    uint16_t step;
+
+    if (pos == target) return 0;
+
+    /* Away from zero is acceleration, from a standstill in either
+     * direction too. Toward zero, and across it, is deceleration. */
+    if ((pos == 0) || ((pos > 0) ? (target > pos) : (target < pos))) {
+        step = ramp->accelStep;
+    } else {
+        step = ramp->decelStep;
+    }
+
+    if (!step) {
+        pos = target;
+    } else if (target > pos) {
+        pos = (target - pos > step) ? pos + step : target;
+        /* Stop at zero, the other direction accelerates. */
+        if ((ramp->pos < 0) && (pos > 0)) pos = 0;
+    } else {
+        pos = (pos - target > step) ? pos - step : target;
+        if ((ramp->pos > 0) && (pos < 0)) pos = 0;
+    }
+    ramp->pos = pos;
+
+    /* Truncated toward zero, the same in both directions. */
+    if ((int16_t)(pos / 256) == motorSetpoints[motor].speed) return 0;
+    motorStage(motor, pos / 256);
+    return 1;
+}
+
+static void motorSetTarget(uint8_t motor, int16_t speed) {
+    /* Call with interrupts off. */
+    motorRampState *ramp = &motorRamps[motor];
+    motorSetpoint *setpoint = &motorSetpoints[motor];
+
+    /* The ramp starts from the direct speed, at the compensated duty. */
+    if (setpoint->direct) {
+        setpoint->direct = 0;
+        motorStage(motor, setpoint->speed);
+        motorStart();
+    }
+    ramp->target = motorClamp(speed);
+    /* Without limits the speed is staged right away, with them the tick
+     * takes the steps, however often the target changes. */
+    if (!ramp->accelStep && !ramp->decelStep && motorRampMove(motor)) motorStart();
+}
+
+void setSpeedM1(int16_t speed) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        motorSetTarget(0, speed);
+    }
+}
+
+void setSpeedM2(int16_t speed) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        motorSetTarget(1, speed);
+    }
+}
+
+void setSpeeds(int16_t m1, int16_t m2) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        motorSetTarget(0, m1);
+        motorSetTarget(1, m2);
+    }
+}
+
+void setSpeedDirect(uint8_t motor, int16_t speed) {
+    motorRampState *ramp = &motorRamps[motor - 1];
+    motorSetpoint *setpoint = &motorSetpoints[motor - 1];
+
+    speed = motorClamp(speed);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        /* The ramp follows along, so a later target starts from here. */
+        ramp->target = speed;
+        ramp->pos = (int32_t)speed * 256;
+        if (!setpoint->direct || (speed != setpoint->speed)) {
+            setpoint->direct = 1;
+            motorStage(motor - 1, speed);
+            motorStart();
+        }
+    }
+}
+
+static void motorStop(uint8_t motor) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        motorRamps[motor].target = 0;
+        motorRamps[motor].pos = 0;
+        motorSetpoints[motor].direct = 0;
+        motorStage(motor, 0);
+        motorStart();
+    }
+}
+
+void stopM1(void) {
+    motorStop(0);
+}
+
+void stopM2(void) {
+    motorStop(1);
+}
+
+int16_t getSpeedM1(void) {
+    return motorRamps[0].target;
+}
+
+int16_t getSpeedM2(void) {
+    return motorRamps[1].target;
+}
+
+int16_t getRamp(uint8_t motor) {
+    int16_t speed;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        speed = motorSetpoints[motor - 1].speed;
+    }
+    return speed;
+}
+
+void setAccel(uint8_t motor, uint16_t accel) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        motorRamps[motor - 1].accel = accel;
+        motorRamps[motor - 1].accelStep = motorRampStep(accel);
+    }
+}
+
+uint16_t getAccel(uint8_t motor) {
+    return motorRamps[motor - 1].accel;
+}
+
+void setDecel(uint8_t motor, uint16_t decel) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        motorRamps[motor - 1].decel = decel;
+        motorRamps[motor - 1].decelStep = motorRampStep(decel);
+    }
+}
+
+uint16_t getDecel(uint8_t motor) {
+    return motorRamps[motor - 1].decel;
+}
+
+void motorRamp(void) {
+    /* Both move in the same millisecond, so they are committed together. */
+    uint8_t staged = motorRampMove(0);
+
+    staged |= motorRampMove(1);
+    if (staged) motorStart();
+}
+
+void setSupply(uint16_t vbat) {
+    uint32_t scale = MOTOR_SUPPLY_ONE * 2;
+
+    /* Below half the nominal voltage, as with a divider come loose, the
+     * scale stays at twice. */
+    if (vbat > VBAT_NOMINAL << (ADC_FRACTION_BITS - 1)) {
+        scale = ((uint32_t)VBAT_NOMINAL << (MOTOR_SUPPLY_SHIFT + ADC_FRACTION_BITS)) / vbat;
+    }
+    if (scale == motorSupplyScale) return;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        /* The same speeds at another duty. */
+        motorSupplyScale = scale;
+        motorStage(0, motorSetpoints[0].speed);
+        motorStage(1, motorSetpoints[1].speed);
+        motorStart();
+    }
+}
+
+uint16_t getSupply(void) {
+    return ((uint32_t)motorSupplyScale * 1000) >> MOTOR_SUPPLY_SHIFT;
+}
+
+uint8_t motorBusy(void) {
+    return (TIMSK0 & (1<<TOIE0)) != 0;
+}
+
+ISR(TIMER0_OVF_vect) {
+    /* Timer 0 and 1 run in step and are both at BOTTOM, where the bridges
+     * are off in DISABLE_PWM mode. The compare values written here take
+     * effect at TOP, half a period on, for both motors alike. */
+    uint8_t pending = motorPending;
+
+    if (pending & 0x01) motorCommit(0);
+    if (pending & 0x02) motorCommit(1);
+    /* Stays on for one more period, after which the values are in effect,
+     * see motorBusy(). */
+    if (!pending) TIMSK0 &= ~(1<<TOIE0);
+}
+
 void setEnableM1(uint8_t state) {
     /* This function controls the enable of the H-bridge.
      * If enable is set to zero, the device will enter sleep mode.
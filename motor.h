@@ -1,28 +1,94 @@
 #ifndef MOTOR_H_
 #define MOTOR_H_
 
-/* Function to setup the proper PWM channels. */
+/* Function to setup the proper PWM channels.
+ * The PWM frequency is the one last set with setPwmFreq(). */
 void initPwm(void);
 
+/* Switches both timers to the available PWM frequency closest to the
+ * given one in Hz, and keeps it in EEPROM. The choices are 38, 153, 613,
+ * 4902 and 39216 Hz. Both timers restart in step, the speeds are kept.
+ * Returns 0 and changes nothing if the closest one is more than 25% off. */
+uint8_t setPwmFreq(uint16_t freq);
+
+/* Returns the PWM frequency in Hz. */
+uint16_t getPwmFreq(void);
+
+/* Full speed in either direction, see setSpeedM1(). */
+#define MOTOR_SPEED_MAX 1023
+
+/* PWM period of timer 0 in counts, it is an 8-bit timer. Timer 1 counts
+ * up to ICR1, set to match the frequency, see setPwmFreq(). */
+#define MOTOR_M1_TOP    0xFF
+
 /* Function to set the speed and direction of M1.
  * Positive speed => Forward.
  * Negative speed => Reverse. 
  *
- * Note that the function maps the value ranges
- * 1:1:127 => 2:2:254
- * -1:1:-128 => 1:2:255
- * due to how the int8_t is represented. */
-void setSpeedM1(int8_t speed);
+ * The speed ranges -MOTOR_SPEED_MAX:1:MOTOR_SPEED_MAX for both motors,
+ * values beyond are clamped. The magnitude is scaled to the resolution
+ * of the timer, the same in both directions.
+ *
+ * The speed is a target the ramp walks toward, see setAccel(). Each step
+ * is staged and takes effect at the start of a PWM period, together with
+ * whatever else is staged by then. A reversal keeps the bridge off for
+ * one period in between in DISABLE_PWM mode. */
+void setSpeedM1(int16_t speed);
 
 /* Function to set the speed and direction of M2 (rotated motor).
  * Positive speed => Forward.
  * Negative speed => Reverse. 
  *
- * Note that the function maps the value ranges
- * 1:1:127 => 2:2:254
- * -1:1:-128 => 1:2:255
- * due to how the int8_t is represented. */
-void setSpeedM2(int8_t speed);
+ * Same range as setSpeedM1(). */
+void setSpeedM2(int16_t speed);
+
+/* Sets the speeds of both motors, they take effect in the same PWM
+ * period. Same range as setSpeedM1(). */
+void setSpeeds(int16_t m1, int16_t m2);
+
+/* Sets the speed of motor 1 or 2 at once, past the ramp and without the
+ * supply compensation, for a control loop that closes over the duty
+ * itself, see torque.h. The next target set with setSpeedM1() and the
+ * like ramps from there, compensated again. Same range as setSpeedM1(). */
+void setSpeedDirect(uint8_t motor, int16_t speed);
+
+/* Supply compensation, see VBAT_ADC in config.h. Scales the duty of both
+ * motors by VBAT_NOMINAL / vbat, so a speed keeps its motor voltage as the
+ * battery sags, up to twice and full duty. vbat is a battery sample as
+ * returned by adcGetSlot(). The speeds are restaged at the new scale,
+ * except those set with setSpeedDirect(). */
+void setSupply(uint16_t vbat);
+
+/* Returns the duty scale in thousandths, 1000 without compensation. */
+uint16_t getSupply(void);
+
+/* Returns nonzero until the speeds set are in effect, at most two PWM
+ * periods, three after a reversal. Needs interrupts on. */
+uint8_t motorBusy(void);
+
+/* Set the speed to zero at once, bypassing the ramp. */
+void stopM1(void);
+void stopM2(void);
+
+/* Return the speed last set, after clamping. */
+int16_t getSpeedM1(void);
+int16_t getSpeedM2(void);
+
+/* Returns the speed the ramp of motor 1 or 2 has reached. */
+int16_t getRamp(uint8_t motor);
+
+/* Limit how fast the speed of motor 1 or 2 may rise (accel) and fall
+ * (decel) in magnitude, in speed units per second. 0 is no limit, 1023
+ * goes from stop to full speed in a second. Through zero the speed
+ * decelerates to a stop first and then accelerates. */
+void setAccel(uint8_t motor, uint16_t accel);
+uint16_t getAccel(uint8_t motor);
+void setDecel(uint8_t motor, uint16_t decel);
+uint16_t getDecel(uint8_t motor);
+
+/* Moves both ramps one step, called every millisecond by the tick
+ * interrupt. */
+void motorRamp(void);
 
 /* This function controls the enable of the H-bridge.
  * If enable is set to zero, the device will enter sleep mode.
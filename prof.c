@@ -0,0 +1,70 @@
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "config.h"
+#include "prof.h"
+
+#if PROF_ENABLE
+
+volatile uint16_t profBase;
+
+static profStat profStats[PROF_COUNT];
+
+static const char profNameAdc[] PROGMEM = "adc";
+static const char profNameUart0Rx[] PROGMEM = "uart0rx";
+static const char profNameUart0Tx[] PROGMEM = "uart0tx";
+static const char profNameUart1Rx[] PROGMEM = "uart1rx";
+static const char profNameUart1Tx[] PROGMEM = "uart1tx";
+static const char profNameCmd[] PROGMEM = "cmd";
+
+/* Indexed by probe. */
+static PGM_P const profNames[PROF_COUNT] PROGMEM = {
+    profNameAdc,
+    profNameUart0Rx,
+    profNameUart0Tx,
+    profNameUart1Rx,
+    profNameUart1Tx,
+    profNameCmd,
+};
+
+void profRecord(uint8_t probe, uint16_t duration) {
+    profStat *stat = &profStats[probe];
+    uint16_t scaled = duration >> 2;
+    uint8_t bucket = 0;
+
+    /* Find the bucket by the position of the top bit. */
+    while (scaled && (bucket < PROF_BUCKETS - 1)) {
+        scaled >>= 1;
+        bucket++;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (stat->count != 0xFFFF) {
+            if ((stat->count == 0) || (duration < stat->min)) stat->min = duration;
+            stat->count++;
+            stat->sum += duration;
+        }
+        if (duration > stat->max) stat->max = duration;
+        if (stat->hist[bucket] != 0xFFFF) stat->hist[bucket]++;
+    }
+}
+
+void profReset(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memset(profStats, 0, sizeof(profStats));
+    }
+}
+
+void profRead(uint8_t probe, profStat *stat) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        *stat = profStats[probe];
+    }
+}
+
+PGM_P profName(uint8_t probe) {
+    return (PGM_P)pgm_read_word(&profNames[probe]);
+}
+
+#endif /* PROF_ENABLE */
@@ -0,0 +1,87 @@
+#ifndef PROF_H_
+#define PROF_H_
+
+/* Execution time profiling.
+ *
+ * Probes time a stretch of code with PROF_BEGIN() and PROF_END() and keep
+ * count, min, max, mean and a histogram of the durations, see "get prof"
+ * on the console. The clock is Timer 2, which runs at F_CPU/8 when
+ * profiling is enabled, so durations come in units of 8 cycles (0.4us at
+ * 20MHz) and must stay below 65536 units (26ms).
+ *
+ * Probes in interrupts start after the register save of the handler, so
+ * the interrupt entry and exit overhead is not included.
+ *
+ * With PROF_ENABLE set to 0 in config.h the probes compile to nothing. */
+
+/* Probes. */
+#define PROF_ADC        0   /* ADC conversion complete interrupt. */
+#define PROF_UART0_RX   1   /* UART0 receive interrupt. */
+#define PROF_UART0_TX   2   /* UART0 data register empty interrupt. */
+#define PROF_UART1_RX   3
+#define PROF_UART1_TX   4
+#define PROF_CMD        5   /* Parsing and executing one command. */
+#define PROF_COUNT      6
+
+/* Histogram bucket n counts durations below 4 << n units,
+ * the last one everything longer. */
+#define PROF_BUCKETS    8
+
+/* Timer 2 counts per tick interrupt, see tick.c. */
+#define PROF_TICK_PERIOD 250
+
+typedef struct profStat_ {
+    uint16_t count;     /* Stops at 0xFFFF, as does sum. */
+    uint16_t min;
+    uint16_t max;
+    uint32_t sum;
+    uint16_t hist[PROF_BUCKETS];
+} profStat;
+
+#if PROF_ENABLE
+
+/* Timer 2 counts gone by before the last tick interrupt. */
+extern volatile uint16_t profBase;
+
+static inline uint16_t profNow(void) {
+    /* Returns a timestamp in units of 8 cycles. */
+    uint8_t sreg = SREG;
+    uint8_t count;
+    uint16_t base;
+
+    cli();
+    count = TCNT2;
+    base = profBase;
+    /* The counter wrapped but the tick interrupt has not run yet. */
+    if ((TIFR2 & (1<<OCF2A)) && (count < PROF_TICK_PERIOD / 2)) {
+        base += PROF_TICK_PERIOD;
+    }
+    SREG = sreg;
+    return base + count;
+}
+
+#define PROF_BEGIN(probe)   uint16_t profStart_##probe = profNow()
+#define PROF_END(probe)     profRecord((probe), profNow() - profStart_##probe)
+
+#else
+
+#define PROF_BEGIN(probe)
+#define PROF_END(probe)
+
+#endif /* PROF_ENABLE */
+
+/* The functions below only exist with PROF_ENABLE set. */
+
+/* Adds one duration, in units of 8 cycles, to the statistics of a probe. */
+void profRecord(uint8_t probe, uint16_t duration);
+
+/* Clears the statistics of all probes. */
+void profReset(void);
+
+/* Copies the statistics of a probe. */
+void profRead(uint8_t probe, profStat *stat);
+
+/* Returns the name of a probe, in flash. */
+PGM_P profName(uint8_t probe);
+
+#endif /* PROF_H_ */
@@ -0,0 +1,640 @@
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "config.h"
+#include "prop.h"
+#include "motor.h"
+#include "adc.h"
+#include "uart.h"
+#include "astring.h"
+#include "cmd.h"
+#include "proto.h"
+#include "fault.h"
+#include "failsafe.h"
+#include "torque.h"
+#include "scope.h"
+
+/*
+ * Accessors.
+ */
+
+/* m1speed and m2speed take the old int8 range, scaled to the motor speed
+ * range in both directions alike. */
+#define PROP_SPEED_MAX  127
+
+static int16_t propScale(int16_t value, int16_t from, int16_t to) {
+    /* Rescales a signed value, rounded to nearest. */
+    int32_t scaled = (int32_t)value * to;
+    scaled += (value < 0) ? -(from / 2) : (from / 2);
+    return scaled / from;
+}
+
+static int16_t propGetDuty(uint8_t motor) {
+    return (motor == 1) ? getSpeedM1() : getSpeedM2();
+}
+
+static uint8_t propSetDuty(uint8_t motor, int16_t value) {
+    failsafeFeed();
+    torqueOff(motor);
+    if (motor == 1) {
+        setSpeedM1(value);
+    } else {
+        setSpeedM2(value);
+    }
+    scopeTrigger(SCOPE_TRIG_SPEED);
+    return PROP_OK;
+}
+
+static int16_t propGetSpeed(uint8_t motor) {
+    return propScale(propGetDuty(motor), MOTOR_SPEED_MAX, PROP_SPEED_MAX);
+}
+
+static uint8_t propSetSpeed(uint8_t motor, int16_t value) {
+    /* -128 is clamped to full reverse. */
+    return propSetDuty(motor, propScale(value, PROP_SPEED_MAX, MOTOR_SPEED_MAX));
+}
+
+static int16_t propGetDrive(uint8_t arg) {
+    return (uint8_t)propGetSpeed(1) | ((uint16_t)propGetSpeed(2) << 8);
+}
+
+static uint8_t propSetDrive(uint8_t arg, int16_t value) {
+    /* m1speed in the low byte and m2speed in the high byte, set as one
+     * so both take effect in the same PWM period. */
+    failsafeFeed();
+    torqueOff(1);
+    torqueOff(2);
+    setSpeeds(propScale((int8_t)value, PROP_SPEED_MAX, MOTOR_SPEED_MAX),
+              propScale((int8_t)(value >> 8), PROP_SPEED_MAX, MOTOR_SPEED_MAX));
+    scopeTrigger(SCOPE_TRIG_SPEED);
+    return PROP_OK;
+}
+
+static int16_t propGetRamp(uint8_t motor) {
+    return getRamp(motor);
+}
+
+static int16_t propGetAccel(uint8_t motor) {
+    return getAccel(motor);
+}
+
+static uint8_t propSetAccel(uint8_t motor, int16_t value) {
+    setAccel(motor, value);
+    return PROP_OK;
+}
+
+static int16_t propGetDecel(uint8_t motor) {
+    return getDecel(motor);
+}
+
+static uint8_t propSetDecel(uint8_t motor, int16_t value) {
+    setDecel(motor, value);
+    return PROP_OK;
+}
+
+static int16_t propGetTorque(uint8_t motor) {
+    return torqueGet(motor);
+}
+
+static uint8_t propSetTorque(uint8_t motor, int16_t value) {
+    failsafeFeed();
+    torqueSet(motor, value);
+    return PROP_OK;
+}
+
+static int16_t propGetGain(uint8_t arg) {
+    return (arg == 'p') ? torqueGetKp() : torqueGetKi();
+}
+
+static uint8_t propSetGain(uint8_t arg, int16_t value) {
+    if (arg == 'p') {
+        torqueSetKp(value);
+    } else {
+        torqueSetKi(value);
+    }
+    return PROP_OK;
+}
+
+#if !DISABLE_PWM
+static int16_t propGetDisable(uint8_t motor) {
+    if (motor == 1) {
+        return 0x1&(M1_PIN>>PA1);
+    } else {
+        return 0x1&(M2_PIN>>PA5);
+    }
+}
+
+static uint8_t propSetDisable(uint8_t motor, int16_t value) {
+    if (motor == 1) {
+        setDisableM1(value);
+    } else {
+        setDisableM2(value);
+    }
+    return PROP_OK;
+}
+#else
+#define propGetDisable 0
+#define propSetDisable 0
+#endif /* DISABLE_PWM */
+
+static int16_t propGetLed(uint8_t led) {
+    return (LEDREG & led) ? 1 : 0;
+}
+
+static uint8_t propSetLed(uint8_t led, int16_t value) {
+    if (value) {
+        LEDREG |= led;
+    } else {
+        LEDREG &= ~led;
+    }
+    return PROP_OK;
+}
+
+static int16_t propGetCurrent(uint8_t motor) {
+    return (motor == 1) ? lastAdcValM1 : lastAdcValM2;
+}
+
+static int16_t propGetAvg(uint8_t motor) {
+    return adcGetAvg(motor);
+}
+
+static int16_t propGetFilt(uint8_t motor) {
+    return adcGetFilt(motor);
+}
+
+static int16_t propGetOversample(uint8_t arg) {
+    return 1 << (2 * adcGetOversample());
+}
+
+static uint8_t propSetOversample(uint8_t arg, int16_t value) {
+    /* 1, 4, 16 or 64 samples. */
+    uint8_t log4;
+
+    for (log4 = 0; log4 < 4; log4++) {
+        if (value == (1 << (2 * log4))) {
+            adcSetOversample(log4);
+            return PROP_OK;
+        }
+    }
+    return PROP_ERR_RANGE;
+}
+
+static int16_t propGetFilter(uint8_t arg) {
+    return adcGetFilter();
+}
+
+static uint8_t propSetFilter(uint8_t arg, int16_t value) {
+    adcSetFilter(value);
+    return PROP_OK;
+}
+
+static int16_t propGetScope(uint8_t arg) {
+    return scopeState();
+}
+
+static uint8_t propSetScope(uint8_t arg, int16_t value) {
+    /* 0 stops, 1 arms and 2 forces the trigger. */
+    if (value == 0) {
+        scopeStop();
+    } else if (value == 1) {
+        scopeArm();
+    } else {
+        scopeTrigger(SCOPE_TRIG_FORCE);
+    }
+    return PROP_OK;
+}
+
+static int16_t propGetScopeData(uint8_t arg) {
+    return scopeBlockSize();
+}
+
+static int16_t propGetScopeMotor(uint8_t arg) {
+    return scopeGetMotor();
+}
+
+static uint8_t propSetScopeMotor(uint8_t arg, int16_t value) {
+    scopeSetMotor(value);
+    return PROP_OK;
+}
+
+static int16_t propGetScopeBits(uint8_t arg) {
+    return scopeGetBits();
+}
+
+static uint8_t propSetScopeBits(uint8_t arg, int16_t value) {
+    if ((value != 8) && (value != 10)) return PROP_ERR_RANGE;
+    scopeSetBits(value);
+    return PROP_OK;
+}
+
+static int16_t propGetScopeTrig(uint8_t arg) {
+    return scopeGetTriggers();
+}
+
+static uint8_t propSetScopeTrig(uint8_t arg, int16_t value) {
+    scopeSetTriggers(value);
+    return PROP_OK;
+}
+
+static int16_t propGetScopeLevel(uint8_t arg) {
+    return scopeGetLevel();
+}
+
+static uint8_t propSetScopeLevel(uint8_t arg, int16_t value) {
+    scopeSetLevel(value);
+    return PROP_OK;
+}
+
+static int16_t propGetScopePre(uint8_t arg) {
+    return scopeGetPre();
+}
+
+static uint8_t propSetScopePre(uint8_t arg, int16_t value) {
+    scopeSetPre(value);
+    return PROP_OK;
+}
+
+#ifdef VBAT_ADC
+static int16_t propGetVbat(uint8_t arg) {
+    return adcGetSlot(ADC_SLOT_VBAT);
+}
+
+static int16_t propGetSupply(uint8_t arg) {
+    return getSupply();
+}
+#else
+#define propGetVbat 0
+#define propGetSupply 0
+#endif /* VBAT_ADC */
+
+#ifdef TEMP_ADC
+static int16_t propGetTemp(uint8_t arg) {
+    return adcGetSlot(ADC_SLOT_TEMP);
+}
+#else
+#define propGetTemp 0
+#endif /* TEMP_ADC */
+
+static int16_t propGetMode(uint8_t port) {
+    return cmdSessions[port].mode;
+}
+
+static uint8_t propSetMode(uint8_t port, int16_t value) {
+    cmdSetMode(&cmdSessions[port], value);
+    return PROP_OK;
+}
+
+static int16_t propGetEcho(uint8_t port) {
+    return cmdSessions[port].echo;
+}
+
+static uint8_t propSetEcho(uint8_t port, int16_t value) {
+    cmdSetEcho(&cmdSessions[port], value);
+    return PROP_OK;
+}
+
+static int16_t propGetBaud(uint8_t port) {
+    return cmdSessions[port].baud;
+}
+
+static uint8_t propSetBaud(uint8_t port, int16_t value) {
+    return cmdSetBaud(&cmdSessions[port], value);
+}
+
+static int16_t propGetTxDropped(uint8_t port) {
+    return uart_txdropped(port);
+}
+
+static int16_t propGetFault(uint8_t arg) {
+    return faultGet();
+}
+
+static uint8_t propSetFault(uint8_t arg, int16_t value) {
+    /* Writing zero clears the faults, see faultClear(). */
+    return faultClear() ? PROP_ERR_FAULT : PROP_OK;
+}
+
+static int16_t propGetLimit(uint8_t motor) {
+    return faultGetLimit(motor);
+}
+
+static uint8_t propSetLimit(uint8_t motor, int16_t value) {
+    faultSetLimit(motor, value);
+    return PROP_OK;
+}
+
+static int16_t propGetTrips(uint8_t motor) {
+    return faultGetTrips(motor);
+}
+
+static uint8_t propSetTrips(uint8_t motor, int16_t value) {
+    /* Only zero is in range, it resets the count. */
+    faultClearTrips(motor);
+    return PROP_OK;
+}
+
+static int16_t propGetSamples(uint8_t arg) {
+    return faultSamples;
+}
+
+static uint8_t propSetSamples(uint8_t arg, int16_t value) {
+    faultSamples = value;
+    return PROP_OK;
+}
+
+static int16_t propGetFailsafe(uint8_t arg) {
+    return failsafeGetTimeout();
+}
+
+static uint8_t propSetFailsafe(uint8_t arg, int16_t value) {
+    failsafeSetTimeout(value);
+    return PROP_OK;
+}
+
+static int16_t propGetReset(uint8_t arg) {
+    return failsafeResetCause();
+}
+
+static int16_t propGetPwmFreq(uint8_t arg) {
+    return getPwmFreq();
+}
+
+static uint8_t propSetPwmFreq(uint8_t arg, int16_t value) {
+    /* The closest one available is used, if it is near enough. */
+    if (!setPwmFreq(value)) return PROP_ERR_RANGE;
+    return PROP_OK;
+}
+
+/*
+ * Property table.
+ */
+
+static const char propNameAdcAvg[] PROGMEM = "adcavg";
+static const char propNameAdcFilt[] PROGMEM = "adcfilt";
+static const char propNameDrive[] PROGMEM = "drive";
+static const char propNameFailsafe[] PROGMEM = "failsafe";
+static const char propNameFault[] PROGMEM = "fault";
+static const char propNameLed1[] PROGMEM = "led1";
+static const char propNameLed2[] PROGMEM = "led2";
+static const char propNameLed3[] PROGMEM = "led3";
+static const char propNameLed4[] PROGMEM = "led4";
+static const char propNameM1Accel[] PROGMEM = "m1accel";
+static const char propNameM1Avg[] PROGMEM = "m1avg";
+static const char propNameM1Current[] PROGMEM = "m1current";
+static const char propNameM1Decel[] PROGMEM = "m1decel";
+static const char propNameM1Disable[] PROGMEM = "m1disable";
+static const char propNameM1Duty[] PROGMEM = "m1duty";
+static const char propNameM1Filt[] PROGMEM = "m1filt";
+static const char propNameM1Limit[] PROGMEM = "m1limit";
+static const char propNameM1Ramp[] PROGMEM = "m1ramp";
+static const char propNameM1Speed[] PROGMEM = "m1speed";
+static const char propNameM1Torque[] PROGMEM = "m1torque";
+static const char propNameM1Trips[] PROGMEM = "m1trips";
+static const char propNameM2Accel[] PROGMEM = "m2accel";
+static const char propNameM2Avg[] PROGMEM = "m2avg";
+static const char propNameM2Current[] PROGMEM = "m2current";
+static const char propNameM2Decel[] PROGMEM = "m2decel";
+static const char propNameM2Disable[] PROGMEM = "m2disable";
+static const char propNameM2Duty[] PROGMEM = "m2duty";
+static const char propNameM2Filt[] PROGMEM = "m2filt";
+static const char propNameM2Limit[] PROGMEM = "m2limit";
+static const char propNameM2Ramp[] PROGMEM = "m2ramp";
+static const char propNameM2Speed[] PROGMEM = "m2speed";
+static const char propNameM2Torque[] PROGMEM = "m2torque";
+static const char propNameM2Trips[] PROGMEM = "m2trips";
+static const char propNameOcSamples[] PROGMEM = "ocsamples";
+static const char propNamePwmFreq[] PROGMEM = "pwmfreq";
+static const char propNameReset[] PROGMEM = "reset";
+static const char propNameScope[] PROGMEM = "scope";
+static const char propNameScopeBits[] PROGMEM = "scopebits";
+static const char propNameScopeCh[] PROGMEM = "scopech";
+static const char propNameScopeData[] PROGMEM = "scopedata";
+static const char propNameScopeLevel[] PROGMEM = "scopelevel";
+static const char propNameScopePre[] PROGMEM = "scopepre";
+static const char propNameScopeTrig[] PROGMEM = "scopetrig";
+static const char propNameTemp[] PROGMEM = "temp";
+static const char propNameTorqueKi[] PROGMEM = "torqueki";
+static const char propNameTorqueKp[] PROGMEM = "torquekp";
+static const char propNameUart0Baud[] PROGMEM = "uart0baud";
+static const char propNameUart0Drops[] PROGMEM = "uart0drops";
+static const char propNameUart0Echo[] PROGMEM = "uart0echo";
+static const char propNameUart0Mode[] PROGMEM = "uart0mode";
+static const char propNameUart1Baud[] PROGMEM = "uart1baud";
+static const char propNameUart1Drops[] PROGMEM = "uart1drops";
+static const char propNameUart1Echo[] PROGMEM = "uart1echo";
+static const char propNameUart1Mode[] PROGMEM = "uart1mode";
+static const char propNameVbat[] PROGMEM = "vbat";
+static const char propNameVcomp[] PROGMEM = "vcomp";
+
+#if DISABLE_PWM
+    /* The disable pin carries the PWM, see config.h. */
+    #define PROP_DISABLE_FLAGS  0
+#else
+    #define PROP_DISABLE_FLAGS  PROP_RW
+#endif /* DISABLE_PWM */
+
+/* The optional inputs, see config.h. */
+#ifdef VBAT_ADC
+    #define PROP_VBAT_FLAGS     PROP_READ
+#else
+    #define PROP_VBAT_FLAGS     0
+#endif /* VBAT_ADC */
+#ifdef TEMP_ADC
+    #define PROP_TEMP_FLAGS     PROP_READ
+#else
+    #define PROP_TEMP_FLAGS     0
+#endif /* TEMP_ADC */
+
+/* Indexed by property id - 1, keep in the order of the PROP_* ids. */
+static const propDesc propTable[] PROGMEM = {
+    /* name, type, flags, min, max, get, set, arg */
+    { propNameM1Speed, PROP_TYPE_INT, PROP_RW, -128, 127, propGetSpeed, propSetSpeed, 1 },
+    { propNameM2Speed, PROP_TYPE_INT, PROP_RW, -128, 127, propGetSpeed, propSetSpeed, 2 },
+    { propNameM1Disable, PROP_TYPE_HEX, PROP_DISABLE_FLAGS, 0, 1, propGetDisable, propSetDisable, 1 },
+    { propNameM2Disable, PROP_TYPE_HEX, PROP_DISABLE_FLAGS, 0, 1, propGetDisable, propSetDisable, 2 },
+    { propNameLed1, PROP_TYPE_INT, PROP_RW, 0, 1, propGetLed, propSetLed, LED1 },
+    { propNameLed2, PROP_TYPE_INT, PROP_RW, 0, 1, propGetLed, propSetLed, LED2 },
+    { propNameLed3, PROP_TYPE_INT, PROP_RW, 0, 1, propGetLed, propSetLed, LED3 },
+    { propNameLed4, PROP_TYPE_INT, PROP_RW, 0, 1, propGetLed, propSetLed, LED4 },
+    { propNameM1Current, PROP_TYPE_HEX, PROP_READ, 0, 0x3FF, propGetCurrent, 0, 1 },
+    { propNameM2Current, PROP_TYPE_HEX, PROP_READ, 0, 0x3FF, propGetCurrent, 0, 2 },
+    { propNameUart0Mode, PROP_TYPE_INT, PROP_RW, PROTO_MODE_ASCII, PROTO_MODE_BINARY, propGetMode, propSetMode, CMD_SESSION_UART0 },
+    { propNameUart0Drops, PROP_TYPE_HEX, PROP_READ, 0, 0, propGetTxDropped, 0, UART_PORT0 },
+    { propNameUart1Drops, PROP_TYPE_HEX, PROP_READ, 0, 0, propGetTxDropped, 0, UART_PORT1 },
+    { propNameUart1Mode, PROP_TYPE_INT, PROP_RW, PROTO_MODE_ASCII, PROTO_MODE_BINARY, propGetMode, propSetMode, CMD_SESSION_UART1 },
+    { propNameUart0Echo, PROP_TYPE_INT, PROP_RW, 0, 1, propGetEcho, propSetEcho, CMD_SESSION_UART0 },
+    { propNameUart1Echo, PROP_TYPE_INT, PROP_RW, 0, 1, propGetEcho, propSetEcho, CMD_SESSION_UART1 },
+    /* In units of 100 baud, 12 to 25000. */
+    { propNameUart0Baud, PROP_TYPE_INT, PROP_RW, 12, 25000, propGetBaud, propSetBaud, CMD_SESSION_UART0 },
+    { propNameUart1Baud, PROP_TYPE_INT, PROP_RW, 12, 25000, propGetBaud, propSetBaud, CMD_SESSION_UART1 },
+    /* FAULT_* bits, see fault.h. */
+    { propNameFault, PROP_TYPE_HEX, PROP_RW, 0, 0, propGetFault, propSetFault, 0 },
+    /* Overcurrent cutoff, raw samples as m1current and m2current. */
+    { propNameM1Limit, PROP_TYPE_HEX, PROP_RW, 0, 0x3FF, propGetLimit, propSetLimit, 1 },
+    { propNameM2Limit, PROP_TYPE_HEX, PROP_RW, 0, 0x3FF, propGetLimit, propSetLimit, 2 },
+    { propNameM1Trips, PROP_TYPE_HEX, PROP_RW, 0, 0, propGetTrips, propSetTrips, 1 },
+    { propNameM2Trips, PROP_TYPE_HEX, PROP_RW, 0, 0, propGetTrips, propSetTrips, 2 },
+    { propNameOcSamples, PROP_TYPE_INT, PROP_RW, 1, 255, propGetSamples, propSetSamples, 0 },
+    /* Link timeout in ms, 0 is off. */
+    { propNameFailsafe, PROP_TYPE_INT, PROP_RW, 0, 30000, propGetFailsafe, propSetFailsafe, 0 },
+    /* MCUSR flags of the last reset, WDRF (0x8) for the watchdog. */
+    { propNameReset, PROP_TYPE_HEX, PROP_READ, 0, 0, propGetReset, 0, 0 },
+    /* Speed in full resolution, see setSpeedM1(). */
+    { propNameM1Duty, PROP_TYPE_INT, PROP_RW, -MOTOR_SPEED_MAX, MOTOR_SPEED_MAX, propGetDuty, propSetDuty, 1 },
+    { propNameM2Duty, PROP_TYPE_INT, PROP_RW, -MOTOR_SPEED_MAX, MOTOR_SPEED_MAX, propGetDuty, propSetDuty, 2 },
+    /* Hz, kept in EEPROM, see setPwmFreq(). */
+    { propNamePwmFreq, PROP_TYPE_UINT, PROP_RW, 1, (int16_t)0xFFFF, propGetPwmFreq, propSetPwmFreq, 0 },
+    /* m1speed and m2speed packed in the low and high byte. */
+    { propNameDrive, PROP_TYPE_HEX, PROP_RW, INT16_MIN, INT16_MAX, propGetDrive, propSetDrive, 0 },
+    /* Ramp rates in m1duty units per second, 0 is off, see setAccel(). */
+    { propNameM1Accel, PROP_TYPE_INT, PROP_RW, 0, 30000, propGetAccel, propSetAccel, 1 },
+    { propNameM2Accel, PROP_TYPE_INT, PROP_RW, 0, 30000, propGetAccel, propSetAccel, 2 },
+    { propNameM1Decel, PROP_TYPE_INT, PROP_RW, 0, 30000, propGetDecel, propSetDecel, 1 },
+    { propNameM2Decel, PROP_TYPE_INT, PROP_RW, 0, 30000, propGetDecel, propSetDecel, 2 },
+    /* Speed the ramp has reached, in m1duty units. */
+    { propNameM1Ramp, PROP_TYPE_INT, PROP_READ, -MOTOR_SPEED_MAX, MOTOR_SPEED_MAX, propGetRamp, 0, 1 },
+    { propNameM2Ramp, PROP_TYPE_INT, PROP_READ, -MOTOR_SPEED_MAX, MOTOR_SPEED_MAX, propGetRamp, 0, 2 },
+    /* Current setpoints in raw ADC counts, see torque.h. */
+    { propNameM1Torque, PROP_TYPE_INT, PROP_RW, -0x3FF, 0x3FF, propGetTorque, propSetTorque, 1 },
+    { propNameM2Torque, PROP_TYPE_INT, PROP_RW, -0x3FF, 0x3FF, propGetTorque, propSetTorque, 2 },
+    { propNameTorqueKp, PROP_TYPE_FIXED(3), PROP_RW, 0, 32767, propGetGain, propSetGain, 'p' },
+    { propNameTorqueKi, PROP_TYPE_FIXED(3), PROP_RW, 0, 32767, propGetGain, propSetGain, 'i' },
+    /* Current feedback filters, samples per average and the low-pass
+     * time constant as a power of 2, see adc.h. */
+    { propNameAdcAvg, PROP_TYPE_INT, PROP_RW, 1, 64, propGetOversample, propSetOversample, 0 },
+    { propNameAdcFilt, PROP_TYPE_INT, PROP_RW, 0, 8, propGetFilter, propSetFilter, 0 },
+    /* Filtered m1current and m2current, times 8. */
+    { propNameM1Avg, PROP_TYPE_HEX, PROP_READ, 0, 0x1FF8, propGetAvg, 0, 1 },
+    { propNameM2Avg, PROP_TYPE_HEX, PROP_READ, 0, 0x1FF8, propGetAvg, 0, 2 },
+    { propNameM1Filt, PROP_TYPE_HEX, PROP_READ, 0, 0x1FF8, propGetFilt, 0, 1 },
+    { propNameM2Filt, PROP_TYPE_HEX, PROP_READ, 0, 0x1FF8, propGetFilt, 0, 2 },
+    /* Current capture, SCOPE_* states, see scope.h. */
+    { propNameScope, PROP_TYPE_INT, PROP_RW, 0, 2, propGetScope, propSetScope, 0 },
+    /* Bytes of the capture block, a binary GET returns the block itself. */
+    { propNameScopeData, PROP_TYPE_HEX, PROP_READ, 0, 0, propGetScopeData, 0, 0 },
+    { propNameScopeCh, PROP_TYPE_INT, PROP_RW, 1, 2, propGetScopeMotor, propSetScopeMotor, 0 },
+    { propNameScopeBits, PROP_TYPE_INT, PROP_RW, 8, 10, propGetScopeBits, propSetScopeBits, 0 },
+    /* SCOPE_TRIG_* bits. */
+    { propNameScopeTrig, PROP_TYPE_HEX, PROP_RW, 0, 0x7, propGetScopeTrig, propSetScopeTrig, 0 },
+    { propNameScopeLevel, PROP_TYPE_HEX, PROP_RW, 0, 0x3FF, propGetScopeLevel, propSetScopeLevel, 0 },
+    { propNameScopePre, PROP_TYPE_INT, PROP_RW, 0, 255, propGetScopePre, propSetScopePre, 0 },
+    /* Slow inputs, raw samples times 8 as m1avg. */
+    { propNameVbat, PROP_TYPE_HEX, PROP_VBAT_FLAGS, 0, 0x1FF8, propGetVbat, 0, 0 },
+    { propNameTemp, PROP_TYPE_HEX, PROP_TEMP_FLAGS, 0, 0x1FF8, propGetTemp, 0, 0 },
+    /* Duty scale of the supply compensation, see setSupply(). */
+    { propNameVcomp, PROP_TYPE_FIXED(3), PROP_VBAT_FLAGS, 0, 2000, propGetSupply, 0, 0 },
+};
+
+#define PROP_COUNT (sizeof(propTable) / sizeof(propTable[0]))
+
+/* The binary protocol carries the id in the low six bits of the frame
+ * header, see PROTO_PROP_MASK. */
+typedef char propCountCheck[(PROP_COUNT <= PROTO_PROP_MASK) ? 1 : -1];
+
+/* Property names sorted by name, for propLookup(). */
+static const cmdName propByName[] PROGMEM = {
+    { propNameAdcAvg, PROP_ADCAVG },
+    { propNameAdcFilt, PROP_ADCFILT },
+    { propNameDrive, PROP_DRIVE },
+    { propNameFailsafe, PROP_FAILSAFE },
+    { propNameFault, PROP_FAULT },
+    { propNameLed1, PROP_LED1 },
+    { propNameLed2, PROP_LED2 },
+    { propNameLed3, PROP_LED3 },
+    { propNameLed4, PROP_LED4 },
+    { propNameM1Accel, PROP_M1ACCEL },
+    { propNameM1Avg, PROP_M1AVG },
+    { propNameM1Current, PROP_M1CURRENT },
+    { propNameM1Decel, PROP_M1DECEL },
+    { propNameM1Disable, PROP_M1DISABLE },
+    { propNameM1Duty, PROP_M1DUTY },
+    { propNameM1Filt, PROP_M1FILT },
+    { propNameM1Limit, PROP_M1LIMIT },
+    { propNameM1Ramp, PROP_M1RAMP },
+    { propNameM1Speed, PROP_M1SPEED },
+    { propNameM1Torque, PROP_M1TORQUE },
+    { propNameM1Trips, PROP_M1TRIPS },
+    { propNameM2Accel, PROP_M2ACCEL },
+    { propNameM2Avg, PROP_M2AVG },
+    { propNameM2Current, PROP_M2CURRENT },
+    { propNameM2Decel, PROP_M2DECEL },
+    { propNameM2Disable, PROP_M2DISABLE },
+    { propNameM2Duty, PROP_M2DUTY },
+    { propNameM2Filt, PROP_M2FILT },
+    { propNameM2Limit, PROP_M2LIMIT },
+    { propNameM2Ramp, PROP_M2RAMP },
+    { propNameM2Speed, PROP_M2SPEED },
+    { propNameM2Torque, PROP_M2TORQUE },
+    { propNameM2Trips, PROP_M2TRIPS },
+    { propNameOcSamples, PROP_OCSAMPLES },
+    { propNamePwmFreq, PROP_PWMFREQ },
+    { propNameReset, PROP_RESET },
+    { propNameScope, PROP_SCOPE },
+    { propNameScopeBits, PROP_SCOPEBITS },
+    { propNameScopeCh, PROP_SCOPECH },
+    { propNameScopeData, PROP_SCOPEDATA },
+    { propNameScopeLevel, PROP_SCOPELEVEL },
+    { propNameScopePre, PROP_SCOPEPRE },
+    { propNameScopeTrig, PROP_SCOPETRIG },
+    { propNameTemp, PROP_TEMP },
+    { propNameTorqueKi, PROP_TORQUEKI },
+    { propNameTorqueKp, PROP_TORQUEKP },
+    { propNameUart0Baud, PROP_UART0BAUD },
+    { propNameUart0Drops, PROP_UART0DROPS },
+    { propNameUart0Echo, PROP_UART0ECHO },
+    { propNameUart0Mode, PROP_UART0MODE },
+    { propNameUart1Baud, PROP_UART1BAUD },
+    { propNameUart1Drops, PROP_UART1DROPS },
+    { propNameUart1Echo, PROP_UART1ECHO },
+    { propNameUart1Mode, PROP_UART1MODE },
+    { propNameVbat, PROP_VBAT },
+    { propNameVcomp, PROP_VCOMP },
+};
+
+uint8_t propLookup(const uint8_t *str, uint8_t len) {
+    /* The PROP_LOOKUP_* results equal the CMD_LOOKUP_* ones. */
+    return cmdLookup(str, len, propByName, PROP_COUNT);
+}
+
+static uint8_t propFetch(uint8_t id, propDesc *desc) {
+    /* Copies the descriptor of a property to RAM. Returns 0 if there is none. */
+    if ((id == 0) || (id > PROP_COUNT)) return 0;
+    memcpy_P(desc, &propTable[id - 1], sizeof(propDesc));
+    return 1;
+}
+
+PGM_P propGetName(uint8_t id) {
+    if ((id == 0) || (id > PROP_COUNT)) return 0;
+    return (PGM_P)pgm_read_word(&propTable[id - 1].name);
+}
+
+uint8_t propType(uint8_t id) {
+    propDesc desc;
+    if (!propFetch(id, &desc)) return PROP_TYPE_HEX;
+    return desc.type;
+}
+
+uint8_t propGet(uint8_t id, int16_t *value) {
+    propDesc desc;
+
+    if (!propFetch(id, &desc)) return PROP_ERR_PROPERTY;
+    if (!(desc.flags & PROP_READ)) {
+        return desc.flags ? PROP_ERR_ACCESS : PROP_ERR_NOTIMPL;
+    }
+    *value = desc.get(desc.arg);
+    return PROP_OK;
+}
+
+uint8_t propSet(uint8_t id, int16_t value) {
+    propDesc desc;
+
+    if (!propFetch(id, &desc)) return PROP_ERR_PROPERTY;
+    if (!(desc.flags & PROP_WRITE)) {
+        return desc.flags ? PROP_ERR_ACCESS : PROP_ERR_NOTIMPL;
+    }
+    if (desc.type == PROP_TYPE_UINT) {
+        if (((uint16_t)value < (uint16_t)desc.min) || ((uint16_t)value > (uint16_t)desc.max)) return PROP_ERR_RANGE;
+    } else if ((value < desc.min) || (value > desc.max)) {
+        return PROP_ERR_RANGE;
+    }
+    return desc.set(desc.arg, value);
+}
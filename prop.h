@@ -0,0 +1,126 @@
+#ifndef PROP_H_
+#define PROP_H_
+
+/* Property registry.
+ *
+ * Every property is described by one row of a table in flash, giving its
+ * name, type, access flags, value range and accessor functions. The console
+ * and the binary protocol both go through propGet() and propSet(). */
+
+/* Property identifiers.
+ * These double as the property ids of the binary protocol (see proto.h),
+ * so existing entries must keep their values. New properties go last.
+ * The protocol has six bits for the id, so 63 is the last one possible,
+ * prop.c refuses to build with more. */
+#define PROP_M1SPEED        1
+#define PROP_M2SPEED        2
+#define PROP_M1DISABLE      3
+#define PROP_M2DISABLE      4
+#define PROP_LED1           5
+#define PROP_LED2           6
+#define PROP_LED3           7
+#define PROP_LED4           8
+#define PROP_M1CURRENT      9
+#define PROP_M2CURRENT      10
+#define PROP_UART0MODE      11
+#define PROP_UART0DROPS     12
+#define PROP_UART1DROPS     13
+#define PROP_UART1MODE      14
+#define PROP_UART0ECHO      15
+#define PROP_UART1ECHO      16
+#define PROP_UART0BAUD      17
+#define PROP_UART1BAUD      18
+#define PROP_FAULT          19
+#define PROP_M1LIMIT        20
+#define PROP_M2LIMIT        21
+#define PROP_M1TRIPS        22
+#define PROP_M2TRIPS        23
+#define PROP_OCSAMPLES      24
+#define PROP_FAILSAFE       25
+#define PROP_RESET          26
+#define PROP_M1DUTY         27
+#define PROP_M2DUTY         28
+#define PROP_PWMFREQ        29
+#define PROP_DRIVE          30
+#define PROP_M1ACCEL        31
+#define PROP_M2ACCEL        32
+#define PROP_M1DECEL        33
+#define PROP_M2DECEL        34
+#define PROP_M1RAMP         35
+#define PROP_M2RAMP         36
+#define PROP_M1TORQUE       37
+#define PROP_M2TORQUE       38
+#define PROP_TORQUEKP       39
+#define PROP_TORQUEKI       40
+#define PROP_ADCAVG         41
+#define PROP_ADCFILT        42
+#define PROP_M1AVG          43
+#define PROP_M2AVG          44
+#define PROP_M1FILT         45
+#define PROP_M2FILT         46
+#define PROP_SCOPE          47
+#define PROP_SCOPEDATA      48
+#define PROP_SCOPECH        49
+#define PROP_SCOPEBITS      50
+#define PROP_SCOPETRIG      51
+#define PROP_SCOPELEVEL     52
+#define PROP_SCOPEPRE       53
+#define PROP_VBAT           54
+#define PROP_TEMP           55
+#define PROP_VCOMP          56
+
+/* Status codes returned by propGet() and propSet(). */
+#define PROP_OK             0
+#define PROP_ERR_PROPERTY   1   /* No such property. */
+#define PROP_ERR_NOTIMPL    2   /* Property exists but is not implemented. */
+#define PROP_ERR_ACCESS     3   /* Property can not be accessed that way. */
+#define PROP_ERR_RANGE      4   /* Value out of range for the property. */
+#define PROP_ERR_AMBIGUOUS  5   /* Abbreviation matches several properties. */
+#define PROP_ERR_FAULT      6   /* Refused while a hardware fault is active. */
+
+/* Special results of propLookup(), the same as those of cmdLookup(). */
+#define PROP_LOOKUP_NONE        0
+#define PROP_LOOKUP_AMBIGUOUS   0xFF
+
+/* Access flags. A property with neither is not implemented. */
+#define PROP_READ           0x01
+#define PROP_WRITE          0x02
+#define PROP_RW             (PROP_READ | PROP_WRITE)
+
+/* Value types, decides how the console presents a value. */
+#define PROP_TYPE_HEX       0   /* Raw register or sample value. */
+#define PROP_TYPE_INT       1   /* Signed decimal. */
+#define PROP_TYPE_UINT      2   /* Unsigned decimal, min and max compare unsigned. */
+#define PROP_TYPE_FIXED(decimals) (0x10 | (decimals)) /* Signed fixed-point decimal. */
+#define PROP_TYPE_DECIMALS(type) ((type) & 0x0F)
+
+typedef struct propDesc_ {
+    PGM_P name;
+    uint8_t type;
+    uint8_t flags;
+    int16_t min;
+    int16_t max;
+    int16_t (*get)(uint8_t arg);
+    uint8_t (*set)(uint8_t arg, int16_t value); /* Returns a PROP_* status. */
+    uint8_t arg;    /* Passed to get and set, lets rows share accessors. */
+} propDesc;
+
+/* Looks up a property by name, or by a unique prefix of its name.
+ * Returns the property id, PROP_LOOKUP_NONE or PROP_LOOKUP_AMBIGUOUS. */
+uint8_t propLookup(const uint8_t *str, uint8_t len);
+
+/* Returns the name of a property in flash, 0 if it does not exist. */
+PGM_P propGetName(uint8_t id);
+
+/* Returns the PROP_TYPE_* of a property, PROP_TYPE_HEX if it does not exist. */
+uint8_t propType(uint8_t id);
+
+/* Fetches the value of a property.
+ * Returns PROP_OK and stores the value on success. */
+uint8_t propGet(uint8_t id, int16_t *value);
+
+/* Sets the value of a property after checking access and range.
+ * Returns PROP_OK on success, or the error of the set accessor. */
+uint8_t propSet(uint8_t id, int16_t value);
+
+#endif /* PROP_H_ */
@@ -0,0 +1,177 @@
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+#include "config.h"
+#include "uart.h"
+#include "astring.h"
+#include "cmd.h"
+#include "prop.h"
+#include "scope.h"
+#include "proto.h"
+
+/* Bytes written per protoPollBlock(), a few lines of the loop keep up
+ * with any baud rate. */
+#define PROTO_BLOCK_CHUNK   32
+
+/* A frame longer than the transmit buffer, see protoSendBlock(). */
+typedef struct protoBlock_ {
+    uint8_t (*byte)(uint16_t i);
+    uint16_t len;       /* Payload bytes. */
+    uint16_t pos;       /* Next byte, 0 for the header. */
+    uint8_t header;
+    uint8_t crc;
+    uint8_t sending;
+    uint8_t cut;        /* The last frame was cut short, end it first. */
+} protoBlock;
+
+static protoBlock protoBlocks[CMD_SESSION_COUNT];
+
+static uint8_t protoEncode(uint8_t *out, uint8_t data) {
+    /* Stores one byte, escaping the SLIP special characters.
+     * Returns the number of bytes stored. */
+    if (data == PROTO_END) {
+        out[0] = PROTO_ESC;
+        out[1] = PROTO_ESC_END;
+        return 2;
+    } else if (data == PROTO_ESC) {
+        out[0] = PROTO_ESC;
+        out[1] = PROTO_ESC_ESC;
+        return 2;
+    }
+    out[0] = data;
+    return 1;
+}
+
+void protoSendFrame(cmdSession *session, uint8_t header, const uint8_t *payload, uint8_t len) {
+    /* The frame is encoded completely first and written as one block,
+     * so the transmit policy never lets half a frame out. */
+    protoBlock *block = &protoBlocks[session->port];
+    uint8_t frame[1 + PROTO_FRAME_SIZE * 2 + 1];
+    uint8_t crc = _crc8_ccitt_update(0, header);
+    uint8_t pos = 0;
+
+    /* A block going out is cut short, the host drops the part sent for
+     * its crc and asks again. */
+    if (block->sending) {
+        block->sending = 0;
+        block->cut = 1;
+    }
+    if (block->cut) frame[pos++] = PROTO_END;
+    pos += protoEncode(&frame[pos], header);
+    while (len--) {
+        crc = _crc8_ccitt_update(crc, *payload);
+        pos += protoEncode(&frame[pos], *payload++);
+    }
+    pos += protoEncode(&frame[pos], crc);
+    frame[pos++] = PROTO_END;
+    if (uart_write(session->port, frame, pos) == pos) block->cut = 0;
+}
+
+void protoSendBlock(cmdSession *session, uint8_t header, uint8_t (*byte)(uint16_t i), uint16_t len) {
+    protoBlock *block = &protoBlocks[session->port];
+
+    /* A block still going out is cut short. */
+    if (block->sending) block->cut = 1;
+    block->byte = byte;
+    block->header = header;
+    block->len = len;
+    block->pos = 0;
+    block->crc = 0;
+    block->sending = 1;
+}
+
+uint8_t protoPollBlock(cmdSession *session) {
+    /* Writes as much of the block as fits, the transmit policy never
+     * comes into play. */
+    protoBlock *block = &protoBlocks[session->port];
+    uint8_t chunk[PROTO_BLOCK_CHUNK];
+    uint8_t room;
+    uint8_t pos = 0;
+
+    if (!block->sending) return 0;
+    room = uart_txfree(session->port);
+    if (room > sizeof(chunk)) room = sizeof(chunk);
+
+    if (block->cut) {
+        if (!room) return 1;
+        chunk[pos++] = PROTO_END;
+        block->cut = 0;
+    }
+    /* The header and payload, up to two bytes each escaped. */
+    while ((block->pos <= block->len) && (pos + 2 <= room)) {
+        uint8_t data = block->pos ? block->byte(block->pos - 1) : block->header;
+        block->crc = _crc8_ccitt_update(block->crc, data);
+        pos += protoEncode(&chunk[pos], data);
+        block->pos++;
+    }
+    /* The crc and the end. */
+    if ((block->pos > block->len) && (pos + 3 <= room)) {
+        pos += protoEncode(&chunk[pos], block->crc);
+        chunk[pos++] = PROTO_END;
+        block->sending = 0;
+    }
+    if (pos) uart_write(session->port, chunk, pos);
+    return block->sending;
+}
+
+static void protoNack(cmdSession *session, uint8_t reason) {
+    protoSendFrame(session, PROTO_OP_NACK | (reason & PROTO_PROP_MASK), 0, 0);
+}
+
+uint8_t protoParser(cmdSession *session, const uint8_t *buf, uint8_t len) {
+    uint8_t crc = 0;
+    uint8_t i;
+    uint8_t status;
+    int16_t value;
+
+    /* Single byte frames are line noise, drop them quietly. */
+    if (len < 2) return 0;
+    if (len > PROTO_FRAME_SIZE) { protoNack(session, PROTO_NACK_LENGTH); return 0; }
+
+    /* Running the crc across the appended crc yields zero for a good frame. */
+    for (i = 0; i < len; i++) {
+        crc = _crc8_ccitt_update(crc, buf[i]);
+    }
+    if (crc != 0) { protoNack(session, PROTO_NACK_CRC); return 0; }
+
+    uint8_t header = buf[0];
+    uint8_t prop = header & PROTO_PROP_MASK;
+    uint8_t payloadLen = len - 2; /* Strip header and crc. */
+
+    switch (header & PROTO_OP_MASK) {
+        case PROTO_OP_SET:
+            if (payloadLen == 1) {
+                value = (int8_t)buf[1]; /* Sign extend. */
+            } else if (payloadLen == 2) {
+                value = buf[1] | ((uint16_t)buf[2] << 8);
+            } else {
+                protoNack(session, PROTO_NACK_LENGTH);
+                return 1;
+            }
+            status = propSet(prop, value);
+            if (status == PROP_OK) {
+                protoSendFrame(session, PROTO_OP_ACK | prop, 0, 0);
+            } else {
+                protoNack(session, status);
+            }
+            break;
+        case PROTO_OP_GET:
+            if (payloadLen != 0) { protoNack(session, PROTO_NACK_LENGTH); return 1; }
+            if (prop == PROP_SCOPEDATA) {
+                /* The capture rather than its size, see scope.h. */
+                protoSendBlock(session, PROTO_OP_ACK | prop, scopeBlockByte, scopeBlockSize());
+                break;
+            }
+            status = propGet(prop, &value);
+            if (status == PROP_OK) {
+                uint8_t payload[2] = { (uint8_t)value, (uint8_t)(value >> 8) };
+                protoSendFrame(session, PROTO_OP_ACK | prop, payload, 2);
+            } else {
+                protoNack(session, status);
+            }
+            break;
+        default:
+            protoNack(session, PROTO_NACK_OPCODE);
+    }
+    return 1;
+}
@@ -0,0 +1,89 @@
+#ifndef PROTO_H_
+#define PROTO_H_
+
+/* Binary framed command protocol.
+ *
+ * Frames are SLIP encoded (RFC 1055): every frame is terminated by
+ * PROTO_END, and PROTO_END/PROTO_ESC bytes inside a frame are sent as
+ * PROTO_ESC PROTO_ESC_END and PROTO_ESC PROTO_ESC_ESC respectively.
+ * Senders may also start a frame with PROTO_END to flush line noise.
+ *
+ * A decoded frame is laid out as:
+ *     [header] [payload, 0..PROTO_PAYLOAD_SIZE bytes] [crc]
+ * The two top bits of the header hold the opcode and the remaining six
+ * bits the property id (PROP_* in prop.h). The crc is a CRC-8 (polynomial
+ * 0x07, initial value 0) over the header and payload.
+ *
+ * The payload is a little endian signed integer whose width is given by
+ * its length, one byte for int8 and two for int16.
+ * Unsigned properties (PROP_TYPE_UINT) take the same bits, so values above
+ * 127 need two bytes.
+ *
+ * Requests and replies:
+ *     SET prop value  -> ACK prop             (or NACK reason)
+ *     GET prop        -> ACK prop value16     (or NACK reason)
+ * The low six bits of a NACK header carry the reason, which is either one
+ * of the PROP_ERR_* codes or one of the PROTO_NACK_* codes below.
+ *
+ * Both speeds are set in the same PWM period through PROP_DRIVE, which
+ * takes m1speed in the low byte and m2speed in the high byte.
+ *
+ * The one exception to the payload size is the GET reply of
+ * PROP_SCOPEDATA, which carries a whole current capture, see scope.h.
+ * Any other frame to the session, a reply or an event, cuts it short,
+ * the part sent is ended with PROTO_END and fails the crc. The host asks
+ * again once it has no other requests under way.
+ *
+ * Events, such as a fault, are sent unasked as the GET reply of the
+ * property that changed, ACK prop value16, see cmdEvent() in cmd.h.
+ *
+ * A setpoint such as "set m1speed -100\r" (17 bytes) is thus four bytes
+ * on the wire: 0x01 0x9C crc 0xC0. */
+
+#define PROTO_MODE_ASCII    0
+#define PROTO_MODE_BINARY   1
+
+/* SLIP special characters. */
+#define PROTO_END           0xC0
+#define PROTO_ESC           0xDB
+#define PROTO_ESC_END       0xDC
+#define PROTO_ESC_ESC       0xDD
+
+/* Header layout. */
+#define PROTO_OP_MASK       0xC0
+#define PROTO_PROP_MASK     0x3F
+#define PROTO_OP_SET        0x00
+#define PROTO_OP_GET        0x40
+#define PROTO_OP_ACK        0x80
+#define PROTO_OP_NACK       0xC0
+
+/* NACK reasons not covered by the PROP_ERR_* codes. */
+#define PROTO_NACK_CRC      0x20
+#define PROTO_NACK_LENGTH   0x21
+#define PROTO_NACK_OPCODE   0x22
+
+#define PROTO_PAYLOAD_SIZE  2
+#define PROTO_FRAME_SIZE    (1 + PROTO_PAYLOAD_SIZE + 1)
+
+/* Checks and executes one frame, as unescaped by the UART driver in
+ * UART_MODE_SLIP (crc included in len). Replies go to the given session,
+ * see cmdSession in cmd.h. Returns nonzero if the frame passed the crc check. */
+uint8_t protoParser(cmdSession *session, const uint8_t *buf, uint8_t len);
+
+/* SLIP encodes and sends a frame with the given header and payload
+ * (at most PROTO_PAYLOAD_SIZE bytes) to the session.
+ * The crc is appended automatically. */
+void protoSendFrame(cmdSession *session, uint8_t header, const uint8_t *payload, uint8_t len);
+
+/* Starts a frame with a payload of any length, read byte by byte through
+ * the callback as it goes out. protoPollBlock() writes it as the transmit
+ * buffer makes room, so the main loop never waits for it. Any other frame
+ * sent to the session meanwhile cuts it short, as does another block. */
+void protoSendBlock(cmdSession *session, uint8_t header, uint8_t (*byte)(uint16_t i), uint16_t len);
+
+/* Writes the next part of a block started with protoSendBlock(), called
+ * by cmdPoll() ahead of the requests. Returns nonzero while the block is
+ * going out. */
+uint8_t protoPollBlock(cmdSession *session);
+
+#endif /* PROTO_H_ */
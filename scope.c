@@ -0,0 +1,167 @@
+#include <avr/io.h>
+#include <util/atomic.h>
+#include "config.h"
+#include "adc.h"
+#include "scope.h"
+
+/* Byte positions wrap with a mask. */
+#if (SCOPE_SIZE > 256) || (SCOPE_SIZE & (SCOPE_SIZE - 1))
+    #error SCOPE_SIZE must be a power of 2 up to 256.
+#endif
+
+static uint8_t scopeBuf[SCOPE_SIZE];
+static volatile uint8_t scopeStatus = SCOPE_IDLE;
+static uint8_t scopeDone;
+
+/* Settings. */
+static uint8_t scopeMotor = 1;
+static uint8_t scopeBits = 8;
+static uint8_t scopeTriggers = SCOPE_TRIG_SPEED | SCOPE_TRIG_FAULT;
+static uint16_t scopeLevel = 0x200;
+static uint8_t scopePre = SCOPE_SIZE / 8;
+
+/* The capture under way, or the last one. */
+static uint8_t scopeChannel;    /* Motor 1 or 2. */
+static uint8_t scopeWidth;      /* Bytes per sample. */
+static uint16_t scopeCapacity;  /* Samples the buffer holds. */
+static uint16_t scopeKeep;      /* Samples kept from before the trigger. */
+static uint8_t scopePos;        /* Byte of the next, or oldest, sample. */
+static uint16_t scopeFilled;    /* Samples taken while armed, up to scopeCapacity. */
+static uint16_t scopeLeft;      /* Samples to take after the trigger. */
+static uint16_t scopePrev;      /* Last sample, for the level trigger. */
+static uint8_t scopeFired;      /* The trigger that ended the wait. */
+
+void scopeArm(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        scopeChannel = scopeMotor;
+        scopeWidth = (scopeBits == 8) ? 1 : 2;
+        scopeCapacity = SCOPE_SIZE / scopeWidth;
+        scopeKeep = (scopePre < scopeCapacity) ? scopePre : scopeCapacity - 1;
+        scopePos = 0;
+        scopeFilled = 0;
+        scopePrev = 0xFFFF; /* No crossing on the first sample. */
+        scopeFired = 0;
+        scopeDone = 0;
+        scopeStatus = SCOPE_ARMED;
+        adcCapture(scopeBits);
+    }
+}
+
+void scopeStop(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if ((scopeStatus == SCOPE_ARMED) || (scopeStatus == SCOPE_TRIGGERED)) adcCapture(0);
+        scopeStatus = SCOPE_IDLE;
+    }
+}
+
+uint8_t scopeState(void) {
+    return scopeStatus;
+}
+
+void scopeTrigger(uint8_t trigger) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        /* Waits for the samples from before the trigger first. */
+        if ((scopeStatus == SCOPE_ARMED) && ((scopeTriggers | SCOPE_TRIG_FORCE) & trigger)
+            && (scopeFilled >= scopeKeep)) {
+            scopeStatus = SCOPE_TRIGGERED;
+            scopeFired = trigger;
+            scopeLeft = scopeCapacity - scopeKeep;
+        }
+    }
+}
+
+uint8_t scopeSample(uint8_t motor, uint16_t sample) {
+    if (motor != scopeChannel) return 0;
+
+    if ((scopeStatus == SCOPE_ARMED) && (scopePrev < scopeLevel) && (sample >= scopeLevel)) {
+        scopeTrigger(SCOPE_TRIG_LEVEL);
+    }
+    scopePrev = sample;
+
+    if (scopeWidth == 1) {
+        scopeBuf[scopePos] = sample >> 2;
+    } else {
+        scopeBuf[scopePos] = sample;
+        scopeBuf[scopePos + 1] = sample >> 8;
+    }
+    scopePos = (scopePos + scopeWidth) & (SCOPE_SIZE - 1);
+
+    if (scopeStatus == SCOPE_ARMED) {
+        if (scopeFilled < scopeCapacity) scopeFilled++;
+        return 0;
+    }
+    if (--scopeLeft) return 0;
+
+    /* The buffer is full, the oldest sample is at scopePos. */
+    scopeStatus = SCOPE_DONE;
+    scopeDone = 1;
+    return 1;
+}
+
+uint8_t scopePoll(void) {
+    uint8_t done;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        done = scopeDone;
+        scopeDone = 0;
+    }
+    return done;
+}
+
+void scopeSetMotor(uint8_t motor) {
+    scopeMotor = motor;
+}
+
+uint8_t scopeGetMotor(void) {
+    return scopeMotor;
+}
+
+void scopeSetBits(uint8_t bits) {
+    scopeBits = bits;
+}
+
+uint8_t scopeGetBits(void) {
+    return scopeBits;
+}
+
+void scopeSetTriggers(uint8_t triggers) {
+    scopeTriggers = triggers;
+}
+
+uint8_t scopeGetTriggers(void) {
+    return scopeTriggers;
+}
+
+void scopeSetLevel(uint16_t level) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        scopeLevel = level;
+    }
+}
+
+uint16_t scopeGetLevel(void) {
+    return scopeLevel;
+}
+
+void scopeSetPre(uint8_t pre) {
+    scopePre = pre;
+}
+
+uint8_t scopeGetPre(void) {
+    return scopePre;
+}
+
+uint16_t scopeBlockSize(void) {
+    return (scopeStatus == SCOPE_DONE) ? SCOPE_HEADER_SIZE + scopeCapacity * scopeWidth : 0;
+}
+
+uint8_t scopeBlockByte(uint16_t i) {
+    switch (i) {
+        case 0: return scopeChannel | ((scopeWidth == 1) ? 0x80 : 0);
+        case 1: return scopeFired;
+        case 2: return scopeCapacity;
+        case 3: return scopeCapacity >> 8;
+        case 4: return scopeKeep;
+        case 5: return scopeKeep >> 8;
+    }
+    return scopeBuf[(scopePos + i - SCOPE_HEADER_SIZE) & (SCOPE_SIZE - 1)];
+}
@@ -0,0 +1,86 @@
+#ifndef SCOPE_H_
+#define SCOPE_H_
+
+/* Current capture, for looking at inrush and stall transients.
+ *
+ * While armed the ADC leaves the timer trigger and converts back to back
+ * at a faster clock, still alternating between the motors, see adc.c.
+ * The samples of one motor go to a ring buffer of SCOPE_SIZE bytes, one
+ * byte per sample with 8 bits, two with 10 bits. At 8 bits a motor is
+ * sampled about every 45 us, at 10 bits about every 90 us.
+ *
+ * Once armed and the pre-trigger part of the buffer is full, the first
+ * enabled trigger fills the rest and ends the capture. The ADC then goes
+ * back to the timer trigger.
+ *
+ * Once done the scope property is reported as an event, see cmdEvent(),
+ * and a GET of PROP_SCOPEDATA returns the capture as one block, the
+ * payload of the ACK frame. It goes out from the main loop as the transmit
+ * buffer makes room, see protoSendBlock(), arming again meanwhile garbles
+ * it.
+ * The payload is:
+ *     [motor, 0x80 set for 8 bit samples] [trigger, SCOPE_TRIG_*]
+ *     [samples, uint16] [pre-trigger samples, uint16]
+ *     [samples, oldest first, 10 bit ones as little endian uint16] */
+
+/* States, as read from the scope property. */
+#define SCOPE_IDLE          0
+#define SCOPE_ARMED         1
+#define SCOPE_TRIGGERED     2
+#define SCOPE_DONE          3
+
+/* Triggers. */
+#define SCOPE_TRIG_SPEED    0x01    /* A speed setpoint from the host. */
+#define SCOPE_TRIG_FAULT    0x02    /* A bridge fault or overcurrent. */
+#define SCOPE_TRIG_LEVEL    0x04    /* The current rising to the level. */
+#define SCOPE_TRIG_FORCE    0x80    /* By hand, always enabled. */
+
+/* Size of the header of the block. */
+#define SCOPE_HEADER_SIZE   6
+
+/* Starts a capture, of the motor and with the sample size set. */
+void scopeArm(void);
+
+/* Ends a capture, the ADC goes back to the timer trigger. */
+void scopeStop(void);
+
+/* Returns the SCOPE_* state. */
+uint8_t scopeState(void);
+
+/* Triggers the capture if armed and the trigger is enabled, from any
+ * context. */
+void scopeTrigger(uint8_t trigger);
+
+/* Called by the ADC interrupt with every sample while armed, returns
+ * nonzero if the capture is complete. */
+uint8_t scopeSample(uint8_t motor, uint16_t sample);
+
+/* Nonzero once after a capture completed, for reporting. */
+uint8_t scopePoll(void);
+
+/* Motor 1 or 2 to capture. */
+void scopeSetMotor(uint8_t motor);
+uint8_t scopeGetMotor(void);
+
+/* Sample size, 8 or 10 bits. */
+void scopeSetBits(uint8_t bits);
+uint8_t scopeGetBits(void);
+
+/* SCOPE_TRIG_* bits of the enabled triggers. */
+void scopeSetTriggers(uint8_t triggers);
+uint8_t scopeGetTriggers(void);
+
+/* Raw 10 bit sample the level trigger fires at. */
+void scopeSetLevel(uint16_t level);
+uint16_t scopeGetLevel(void);
+
+/* Samples kept from before the trigger, less than the buffer holds. */
+void scopeSetPre(uint8_t pre);
+uint8_t scopeGetPre(void);
+
+/* Returns the number of bytes of the block, 0 without a capture, and
+ * byte i of it. */
+uint16_t scopeBlockSize(void);
+uint8_t scopeBlockByte(uint16_t i);
+
+#endif /* SCOPE_H_ */
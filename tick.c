@@ -0,0 +1,60 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "config.h"
+#include "tick.h"
+#include "motor.h"
+#include "torque.h"
+#include "fault.h"
+#include "prof.h"
+
+#if PROF_ENABLE
+/* Tick interrupts per millisecond. */
+#define TICK_DIVIDER 10
+#endif /* PROF_ENABLE */
+
+static volatile uint16_t tickCount;
+
+void initTick(void) {
+    /* Mode 2 - CTC with OCR2A as top. */
+    TCCR2A = (1<<WGM21);
+#if PROF_ENABLE
+    /* The counter doubles as the profiling clock and runs as fast as
+     * possible while still reaching a millisecond in whole interrupts.
+     * 20MHz / 8 / 250 gives 10 kHz, every tenth interrupt is a tick. */
+    OCR2A = PROF_TICK_PERIOD - 1;
+    TIMSK2 |= (1<<OCIE2A);
+    /* Prescaler /8, CS21=1. Clock selection ref p. 157 */
+    TCCR2B = (1<<CS21);
+#else
+    /* 20MHz / 128 / 156 gives 1001.6 Hz, close enough for timeouts. */
+    OCR2A = 155;
+    TIMSK2 |= (1<<OCIE2A);
+    /* Prescaler /128, CS22=CS20=1. Clock selection ref p. 157 */
+    TCCR2B = (1<<CS22) | (1<<CS20);
+#endif /* PROF_ENABLE */
+}
+
+uint16_t tickNow(void) {
+    uint16_t now;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        now = tickCount;
+    }
+    return now;
+}
+
+ISR(TIMER2_COMPA_vect) {
+#if PROF_ENABLE
+    static uint8_t divider;
+
+    profBase += PROF_TICK_PERIOD;
+    if (++divider < TICK_DIVIDER) return;
+    divider = 0;
+#endif /* PROF_ENABLE */
+    tickCount++;
+    faultTick();
+    torqueControl();
+    motorRamp();
+}
@@ -0,0 +1,17 @@
+#ifndef TICK_H_
+#define TICK_H_
+
+/* Free running millisecond tick from Timer 2. */
+
+/* Sets up Timer 2 for an interrupt every millisecond. */
+void initTick(void);
+
+/* Returns the milliseconds since initTick(), wrapping at 65536.
+ * Compare times by their difference, see tickElapsed(). */
+uint16_t tickNow(void);
+
+/* Nonzero once the tick has reached the given deadline.
+ * Valid for deadlines up to 32767 ms ahead. */
+#define tickElapsed(deadline) ((int16_t)(tickNow() - (deadline)) >= 0)
+
+#endif /* TICK_H_ */
@@ -0,0 +1,127 @@
+#include <avr/io.h>
+#include <util/atomic.h>
+#include "config.h"
+#include "motor.h"
+#include "adc.h"
+#include "fault.h"
+#include "torque.h"
+
+/* The gains and the integral are fixed-point with this many fraction bits. */
+#define TORQUE_SHIFT    12
+#define TORQUE_Q(gain)  (((int32_t)(gain) << TORQUE_SHIFT) / TORQUE_GAIN_ONE)
+#define TORQUE_OUT_MAX  ((int32_t)MOTOR_SPEED_MAX << TORQUE_SHIFT)
+
+typedef struct torqueLoop_ {
+    uint8_t on;
+    uint8_t sample;     /* adcSamples count of the last update. */
+    int16_t setpoint;   /* Raw ADC counts, the sign is the direction. */
+    int32_t integral;   /* Speed units, TORQUE_SHIFT fraction bits. */
+} torqueLoop;
+
+static torqueLoop torqueLoops[2];
+
+static uint16_t torqueKp = TORQUE_KP_DEFAULT;
+static uint16_t torqueKi = TORQUE_KI_DEFAULT;
+static int32_t torqueKpQ = TORQUE_Q(TORQUE_KP_DEFAULT);
+static int32_t torqueKiQ = TORQUE_Q(TORQUE_KI_DEFAULT);
+
+void torqueSet(uint8_t motor, int16_t current) {
+    torqueLoop *loop = &torqueLoops[motor - 1];
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        /* Starts from zero, and over again on a reversal. */
+        if (!loop->on || ((current < 0) != (loop->setpoint < 0))) loop->integral = 0;
+        loop->setpoint = current;
+        loop->on = 1;
+    }
+}
+
+int16_t torqueGet(uint8_t motor) {
+    int16_t current = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (torqueLoops[motor - 1].on) current = torqueLoops[motor - 1].setpoint;
+    }
+    return current;
+}
+
+void torqueOff(uint8_t motor) {
+    torqueLoops[motor - 1].on = 0;
+}
+
+void torqueSetKp(uint16_t kp) {
+    int32_t q = TORQUE_Q(kp);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        torqueKp = kp;
+        torqueKpQ = q;
+    }
+}
+
+uint16_t torqueGetKp(void) {
+    return torqueKp;
+}
+
+void torqueSetKi(uint16_t ki) {
+    int32_t q = TORQUE_Q(ki);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        torqueKi = ki;
+        torqueKiQ = q;
+    }
+}
+
+uint16_t torqueGetKi(void) {
+    return torqueKi;
+}
+
+static int16_t torqueStep(torqueLoop *loop, uint16_t sample) {
+    /* One PI update per sample, returns the speed. */
+    int16_t magnitude = (loop->setpoint < 0) ? -loop->setpoint : loop->setpoint;
+    int16_t error = magnitude - sample;
+    int32_t integral = loop->integral + torqueKiQ * error;
+    int32_t out = torqueKpQ * error + integral;
+
+    /* Anti-windup: the integral holds while the output is saturated in
+     * the direction the error pushes, and never leaves the output range. */
+    if (out > TORQUE_OUT_MAX) {
+        out = TORQUE_OUT_MAX;
+        if (error > 0) integral = loop->integral;
+    } else if (out < 0) {
+        out = 0;
+        if (error < 0) integral = loop->integral;
+    }
+    if (integral > TORQUE_OUT_MAX) {
+        integral = TORQUE_OUT_MAX;
+    } else if (integral < 0) {
+        integral = 0;
+    }
+    loop->integral = integral;
+
+    out >>= TORQUE_SHIFT;
+    return (loop->setpoint < 0) ? -out : out;
+}
+
+void torqueControl(void) {
+    uint8_t faults = faultGet();
+
+    /* Only a new sample is integrated, the loop runs more often than the
+     * motors are sampled at the lower PWM frequencies. */
+    if (torqueLoops[0].on && (torqueLoops[0].sample != adcSamples[0])) {
+        torqueLoops[0].sample = adcSamples[0];
+        /* A fault clear leaves the motor stopped, as in speed mode. */
+        if (faults & FAULT_M1_ANY) {
+            torqueLoops[0].on = 0;
+        } else {
+            setSpeedDirect(1, torqueStep(&torqueLoops[0], lastAdcValM1));
+        }
+    }
+    if (torqueLoops[1].on && (torqueLoops[1].sample != adcSamples[1])) {
+        torqueLoops[1].sample = adcSamples[1];
+        if (faults & FAULT_M2_ANY) {
+            torqueLoops[1].on = 0;
+        } else {
+            setSpeedDirect(2, torqueStep(&torqueLoops[1], lastAdcValM2));
+        }
+    }
+}
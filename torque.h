@@ -0,0 +1,45 @@
+#ifndef TORQUE_H_
+#define TORQUE_H_
+
+/* Motor current (torque) control.
+ *
+ * In torque mode a PI controller sets the speed of a motor so that its
+ * current feedback (lastAdcValM1, lastAdcValM2) follows a setpoint. The
+ * feedback only gives the magnitude, the sign of the setpoint gives the
+ * direction.
+ *
+ * The tick interrupt looks for a new sample every millisecond and updates
+ * the loop once per sample. Each motor is sampled every other PWM period,
+ * see adc.c, so the loop runs at half the PWM frequency, up to 1 kHz. At
+ * the 153 Hz default that is 76 Hz, the higher frequencies suit torque
+ * mode better, see setPwmFreq().
+ *
+ * The output is the duty, set through setSpeedDirect(), past the ramp
+ * and the supply compensation, the loop makes up for the supply itself.
+ * A speed setpoint, the link timeout and a fault end torque mode. */
+
+/* Gains are given in thousandths, 1000 is a speed unit per ADC count of
+ * error for the proportional part and per ADC count and update for the
+ * integral part. */
+#define TORQUE_GAIN_ONE     1000
+
+/* Puts motor 1 or 2 in torque mode with the given current, in raw ADC
+ * counts of the feedback, -0x3FF:1:0x3FF. */
+void torqueSet(uint8_t motor, int16_t current);
+
+/* Returns the current setpoint, 0 if not in torque mode. */
+int16_t torqueGet(uint8_t motor);
+
+/* Ends torque mode, the speed stays as the controller left it. */
+void torqueOff(uint8_t motor);
+
+/* Gains shared by both motors, in thousandths, 0:1:32767. */
+void torqueSetKp(uint16_t kp);
+uint16_t torqueGetKp(void);
+void torqueSetKi(uint16_t ki);
+uint16_t torqueGetKi(void);
+
+/* Runs the controllers, called every millisecond by the tick interrupt. */
+void torqueControl(void);
+
+#endif /* TORQUE_H_ */
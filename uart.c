@@ -3,17 +3,25 @@ Title:    Interrupt UART library with receive/transmit circular buffers
 Author:   Peter Fleury <pfleury@gmx.ch>   http://jump.to/fleury
 File:     $Id: uart.c,v 1.12 2014/01/08 21:58:12 peter Exp $
 Software: AVR-GCC 4.1, AVR Libc 1.4.6 or higher
-Hardware: any AVR with built-in UART, 
+Hardware: ATmega with two USARTs, such as the ATmega324PA
 License:  GNU General Public License 
           
 DESCRIPTION:
     An interrupt is generated when the UART has finished transmitting or
-    receiving a byte. The interrupt handling routines use circular buffers
-    for buffering received and transmitted data.
+    receiving a byte. The transmit interrupt is fed from a circular buffer.
+    The receive interrupt assembles complete text lines or SLIP frames
+    into a small pool of line slots, so the main loop is only involved
+    once a whole command has arrived.
     
-    The UART_RX_BUFFER_SIZE and UART_TX_BUFFER_SIZE variables define
-    the buffer size in bytes. Note that these variables must be a 
-    power of 2.
+    One driver serves both USARTs. Every port is described by a constant
+    descriptor giving its registers and buffers, the interrupt handlers
+    are instantiated per port from inline functions with the descriptor
+    folded in at compile time.
+
+    The UARTn_TX_BUFFER_SIZE and UARTn_LINE_SLOTS variables define
+    the buffer size in bytes and the number of slots of port n. Note that
+    these variables must be a power of 2. UARTn_LINE_SIZE defines the size
+    of a slot, including the null terminator.
     
 USAGE:
     Refere to the header file uart.h for a description of the routines. 
@@ -36,199 +44,46 @@ LICENSE:
     GNU General Public License for more details.
                         
 *************************************************************************/
+#include <string.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include "config.h"
 #include "uart.h"
+#include "hal.h"
+#include "prof.h"
 
 
 /*
  *  constants and macros
  */
 
-/* size of RX/TX buffers */
-#define UART_RX_BUFFER_MASK ( UART_RX_BUFFER_SIZE - 1)
-#define UART_TX_BUFFER_MASK ( UART_TX_BUFFER_SIZE - 1)
-
-#if ( UART_RX_BUFFER_SIZE & UART_RX_BUFFER_MASK )
-#error RX buffer size is not a power of 2
+#if ( UART0_LINE_SLOTS & (UART0_LINE_SLOTS - 1) ) || ( UART1_LINE_SLOTS & (UART1_LINE_SLOTS - 1) )
+#error number of line slots is not a power of 2
 #endif
-#if ( UART_TX_BUFFER_SIZE & UART_TX_BUFFER_MASK )
+#if ( UART0_TX_BUFFER_SIZE & (UART0_TX_BUFFER_SIZE - 1) ) || ( UART1_TX_BUFFER_SIZE & (UART1_TX_BUFFER_SIZE - 1) )
 #error TX buffer size is not a power of 2
 #endif
 
-#if defined(__AVR_AT90S2313__) \
- || defined(__AVR_AT90S4414__) || defined(__AVR_AT90S4434__) \
- || defined(__AVR_AT90S8515__) || defined(__AVR_AT90S8535__) \
- || defined(__AVR_ATmega103__)
- /* old AVR classic or ATmega103 with one UART */
- #define AT90_UART
- #define UART0_RECEIVE_INTERRUPT   UART_RX_vect 
- #define UART0_TRANSMIT_INTERRUPT  UART_UDRE_vect
- #define UART0_STATUS   USR
- #define UART0_CONTROL  UCR
- #define UART0_DATA     UDR  
- #define UART0_UDRIE    UDRIE
-#elif defined(__AVR_AT90S2333__) || defined(__AVR_AT90S4433__)
- /* old AVR classic with one UART */
- #define AT90_UART
- #define UART0_RECEIVE_INTERRUPT   UART_RX_vect 
- #define UART0_TRANSMIT_INTERRUPT  UART_UDRE_vect
- #define UART0_STATUS   UCSRA
- #define UART0_CONTROL  UCSRB
- #define UART0_DATA     UDR 
- #define UART0_UDRIE    UDRIE
-#elif  defined(__AVR_ATmega8__) || defined(__AVR_ATmega16__) || defined(__AVR_ATmega32__) \
-  || defined(__AVR_ATmega323__)
-  /* ATmega with one USART */
- #define ATMEGA_USART
- #define UART0_RECEIVE_INTERRUPT   USART_RXC_vect
- #define UART0_TRANSMIT_INTERRUPT  USART_UDRE_vect
- #define UART0_STATUS   UCSRA
- #define UART0_CONTROL  UCSRB
- #define UART0_DATA     UDR
- #define UART0_UDRIE    UDRIE
-#elif defined (__AVR_ATmega8515__) || defined(__AVR_ATmega8535__)
- #define ATMEGA_USART
- #define UART0_RECEIVE_INTERRUPT   USART_RX_vect
- #define UART0_TRANSMIT_INTERRUPT  USART_UDRE_vect
- #define UART0_STATUS   UCSRA
- #define UART0_CONTROL  UCSRB
- #define UART0_DATA     UDR
- #define UART0_UDRIE    UDRIE
-#elif defined(__AVR_ATmega163__)
-  /* ATmega163 with one UART */
- #define ATMEGA_UART
- #define UART0_RECEIVE_INTERRUPT   UART_RX_vect
- #define UART0_TRANSMIT_INTERRUPT  UART_UDRE_vect
- #define UART0_STATUS   UCSRA
- #define UART0_CONTROL  UCSRB
- #define UART0_DATA     UDR
- #define UART0_UDRIE    UDRIE
-#elif defined(__AVR_ATmega162__) 
- /* ATmega with two USART */
- #define ATMEGA_USART0
- #define ATMEGA_USART1
- #define UART0_RECEIVE_INTERRUPT   USART0_RXC_vect
- #define UART1_RECEIVE_INTERRUPT   USART1_RXC_vect
- #define UART0_TRANSMIT_INTERRUPT  USART0_UDRE_vect
- #define UART1_TRANSMIT_INTERRUPT  USART1_UDRE_vect
- #define UART0_STATUS   UCSR0A
- #define UART0_CONTROL  UCSR0B
- #define UART0_DATA     UDR0
- #define UART0_UDRIE    UDRIE0
- #define UART1_STATUS   UCSR1A
- #define UART1_CONTROL  UCSR1B
- #define UART1_DATA     UDR1
- #define UART1_UDRIE    UDRIE1
-#elif defined(__AVR_ATmega64__) || defined(__AVR_ATmega128__) 
- /* ATmega with two USART */
- #define ATMEGA_USART0
- #define ATMEGA_USART1
- #define UART0_RECEIVE_INTERRUPT   USART0_RX_vect
- #define UART1_RECEIVE_INTERRUPT   USART1_RX_vect
- #define UART0_TRANSMIT_INTERRUPT  USART0_UDRE_vect
- #define UART1_TRANSMIT_INTERRUPT  USART1_UDRE_vect
- #define UART0_STATUS   UCSR0A
- #define UART0_CONTROL  UCSR0B
- #define UART0_DATA     UDR0
- #define UART0_UDRIE    UDRIE0
- #define UART1_STATUS   UCSR1A
- #define UART1_CONTROL  UCSR1B
- #define UART1_DATA     UDR1
- #define UART1_UDRIE    UDRIE1
-#elif defined(__AVR_ATmega161__)
- /* ATmega with UART */
- #error "AVR ATmega161 currently not supported by this libaray !"
-#elif defined(__AVR_ATmega169__) 
- /* ATmega with one USART */
- #define ATMEGA_USART
- #define UART0_RECEIVE_INTERRUPT   USART0_RX_vect
- #define UART0_TRANSMIT_INTERRUPT  USART0_UDRE_vect
- #define UART0_STATUS   UCSRA
- #define UART0_CONTROL  UCSRB
- #define UART0_DATA     UDR
- #define UART0_UDRIE    UDRIE
-#elif defined(__AVR_ATmega48__) || defined(__AVR_ATmega88__) || defined(__AVR_ATmega168__) || defined(__AVR_ATmega48P__) || defined(__AVR_ATmega88P__) || defined(__AVR_ATmega168P__) || defined(__AVR_ATmega328P__) \
- || defined(__AVR_ATmega3250__) || defined(__AVR_ATmega3290__) ||defined(__AVR_ATmega6450__) || defined(__AVR_ATmega6490__)
- /* ATmega with one USART */
- #define ATMEGA_USART0
- #define UART0_RECEIVE_INTERRUPT   USART_RX_vect
- #define UART0_TRANSMIT_INTERRUPT  USART_UDRE_vect
- #define UART0_STATUS   UCSR0A
- #define UART0_CONTROL  UCSR0B
- #define UART0_DATA     UDR0
- #define UART0_UDRIE    UDRIE0
-#elif defined(__AVR_ATtiny2313__) 
- #define ATMEGA_USART
- #define UART0_RECEIVE_INTERRUPT   USART_RX_vect
- #define UART0_TRANSMIT_INTERRUPT  USART_UDRE_vect
- #define UART0_STATUS   UCSRA
- #define UART0_CONTROL  UCSRB
- #define UART0_DATA     UDR
- #define UART0_UDRIE    UDRIE
-#elif defined(__AVR_ATmega329__) || \
-      defined(__AVR_ATmega649__) || \
-      defined(__AVR_ATmega325__) || \
-      defined(__AVR_ATmega645__) 
-  /* ATmega with one USART */
-  #define ATMEGA_USART0
-  #define UART0_RECEIVE_INTERRUPT   USART0_RX_vect
-  #define UART0_TRANSMIT_INTERRUPT  USART0_UDRE_vect
-  #define UART0_STATUS   UCSR0A
-  #define UART0_CONTROL  UCSR0B
-  #define UART0_DATA     UDR0
-  #define UART0_UDRIE    UDRIE0
-#elif defined(__AVR_ATmega2560__) || defined(__AVR_ATmega2561__) || defined(__AVR_ATmega1280__)  || defined(__AVR_ATmega1281__) || defined(__AVR_ATmega640__)
-/* ATmega with two USART */
-  #define ATMEGA_USART0
-  #define ATMEGA_USART1
-  #define UART0_RECEIVE_INTERRUPT   USART0_RX_vect
-  #define UART1_RECEIVE_INTERRUPT   USART1_RX_vect
-  #define UART0_TRANSMIT_INTERRUPT  USART0_UDRE_vect
-  #define UART1_TRANSMIT_INTERRUPT  USART1_UDRE_vect
-  #define UART0_STATUS   UCSR0A
-  #define UART0_CONTROL  UCSR0B
-  #define UART0_DATA     UDR0
-  #define UART0_UDRIE    UDRIE0
-  #define UART1_STATUS   UCSR1A
-  #define UART1_CONTROL  UCSR1B
-  #define UART1_DATA     UDR1
-  #define UART1_UDRIE    UDRIE1  
-#elif defined(__AVR_ATmega644__)
- /* ATmega with one USART */
- #define ATMEGA_USART0
- #define UART0_RECEIVE_INTERRUPT   USART0_RX_vect
- #define UART0_TRANSMIT_INTERRUPT  USART0_UDRE_vect
- #define UART0_STATUS   UCSR0A
- #define UART0_CONTROL  UCSR0B
- #define UART0_DATA     UDR0
- #define UART0_UDRIE    UDRIE0
-#elif defined(__AVR_ATmega164P__) || defined(__AVR_ATmega324P__) || defined(__AVR_ATmega644P__) || defined(__AVR_ATmega324PA__)
- /* ATmega with two USART */
- #define ATMEGA_USART0
- #define ATMEGA_USART1
- #define UART0_RECEIVE_INTERRUPT   USART0_RX_vect
- #define UART1_RECEIVE_INTERRUPT   USART1_RX_vect
- #define UART0_TRANSMIT_INTERRUPT  USART0_UDRE_vect
- #define UART1_TRANSMIT_INTERRUPT  USART1_UDRE_vect
- #define UART0_STATUS   UCSR0A
- #define UART0_CONTROL  UCSR0B
- #define UART0_DATA     UDR0
- #define UART0_UDRIE    UDRIE0
- #define UART1_STATUS   UCSR1A
- #define UART1_CONTROL  UCSR1B
- #define UART1_DATA     UDR1
- #define UART1_UDRIE    UDRIE1
-#elif defined(__AVR_AT90USB646__) || defined(__AVR_AT90USB1286__) || defined(__AVR_AT90USB647__) || defined(__AVR_AT90USB1287__)
- /* AT90USBxx with one USART */
- #define AT90USB_USART
- #define UART0_RECEIVE_INTERRUPT   USART1_RX_vect
- #define UART0_TRANSMIT_INTERRUPT  USART1_UDRE_vect
- #define UART0_STATUS   UCSR1A
- #define UART0_CONTROL  UCSR1B
- #define UART0_DATA     UDR1
- #define UART0_UDRIE    UDRIE1
+/* receiver state flags */
+#define UART_RX_SLIP      0x01    /* SLIP framing instead of text lines */
+#define UART_RX_ECHO      0x02    /* echo received text */
+#define UART_RX_ESCAPE    0x04    /* last byte was a SLIP escape */
+#define UART_RX_DISCARD   0x08    /* dropping the rest of the current line */
+
+/* SLIP special characters */
+#define SLIP_END          0xC0
+#define SLIP_ESC          0xDB
+#define SLIP_ESC_END      0xDC
+#define SLIP_ESC_ESC      0xDD
+
+/* Only ATmegas with two USARTs of identical layout are supported, the
+   control and status bits of USART1 sit at the same positions as those
+   of USART0, so the USART0 bit names are used for both. */
+#if defined(__AVR_ATmega164P__) || defined(__AVR_ATmega324P__) || defined(__AVR_ATmega644P__) || defined(__AVR_ATmega324PA__) \
+ || defined(__AVR_ATmega1284P__) \
+ || defined(__AVR_ATmega640__) || defined(__AVR_ATmega1280__) || defined(__AVR_ATmega1281__) \
+ || defined(__AVR_ATmega2560__) || defined(__AVR_ATmega2561__)
 #else
  #error "no UART definition for MCU available"
 #endif
@@ -237,453 +92,644 @@ LICENSE:
 /*
  *  module global variables
  */
-static volatile unsigned char UART_TxBuf[UART_TX_BUFFER_SIZE];
-static volatile unsigned char UART_RxBuf[UART_RX_BUFFER_SIZE];
-static volatile unsigned char UART_TxHead;
-static volatile unsigned char UART_TxTail;
-static volatile unsigned char UART_RxHead;
-static volatile unsigned char UART_RxTail;
-static volatile unsigned char UART_LastRxError;
-
-#if defined( ATMEGA_USART1 )
-static volatile unsigned char UART1_TxBuf[UART_TX_BUFFER_SIZE];
-static volatile unsigned char UART1_RxBuf[UART_RX_BUFFER_SIZE];
-static volatile unsigned char UART1_TxHead;
-static volatile unsigned char UART1_TxTail;
-static volatile unsigned char UART1_RxHead;
-static volatile unsigned char UART1_RxTail;
-static volatile unsigned char UART1_LastRxError;
-#endif
 
+/* run time state of a port */
+typedef struct {
+    volatile unsigned char txHead;
+    volatile unsigned char txTail;
+    unsigned char txBusy;       /* set when data was written, see uart_txidle() */
+    unsigned char txPolicy;
+    volatile unsigned int txDropped;
+    volatile unsigned char lastRxError;
+    volatile unsigned char linesReady;
+    unsigned char lineHead;
+    unsigned char lineTail;
+    unsigned char linePos;
+    volatile unsigned char rxFlags;
+} uart_state;
+
+/* constant description of a port */
+typedef struct {
+    volatile unsigned char *status;     /* UCSRnA */
+    volatile unsigned char *control;    /* UCSRnB */
+    volatile unsigned char *format;     /* UCSRnC */
+    volatile unsigned char *ubrrh;
+    volatile unsigned char *ubrrl;
+    volatile unsigned char *data;       /* UDRn */
+    volatile unsigned char *txBuf;
+    unsigned char txMask;
+    unsigned char *lineBuf;             /* lineSlots * lineSize bytes */
+    unsigned char *lineLen;
+    unsigned char lineSlots;
+    unsigned char lineSize;
+    uart_state *state;
+} uart_port;
+
+static uart_state UART_State[UART_PORTS];
+
+static volatile unsigned char UART0_TxBuf[UART0_TX_BUFFER_SIZE];
+static unsigned char UART0_LineBuf[UART0_LINE_SLOTS * UART0_LINE_SIZE];
+static unsigned char UART0_LineLen[UART0_LINE_SLOTS];
+static volatile unsigned char UART1_TxBuf[UART1_TX_BUFFER_SIZE];
+static unsigned char UART1_LineBuf[UART1_LINE_SLOTS * UART1_LINE_SIZE];
+static unsigned char UART1_LineLen[UART1_LINE_SLOTS];
+
+#define UART_PORT_DESC(n) { \
+    &UCSR##n##A, &UCSR##n##B, &UCSR##n##C, &UBRR##n##H, &UBRR##n##L, &UDR##n, \
+    UART##n##_TxBuf, UART##n##_TX_BUFFER_SIZE - 1, \
+    UART##n##_LineBuf, UART##n##_LineLen, UART##n##_LINE_SLOTS, UART##n##_LINE_SIZE, \
+    &UART_State[n] }
+
+/* indexed by port number, the interrupt handlers use constant indices
+   so the compiler resolves their descriptor fields at compile time */
+static const uart_port UART_Port[UART_PORTS] = {
+    UART_PORT_DESC(0),
+    UART_PORT_DESC(1),
+};
+
+
+static inline void uart_echo(const uart_port *p, unsigned char data) __attribute__((always_inline));
+/*************************************************************************
+Function: uart_echo()
+Purpose:  echo a received byte from the receive interrupt, dropped if
+          the ringbuffer is full since an interrupt can not wait for it
+Input:    port and byte to be transmitted
+Returns:  none
+**************************************************************************/
+static inline void uart_echo(const uart_port *p, unsigned char data)
+{
+    uart_state *s = p->state;
+    unsigned char tmphead;
 
 
-ISR (UART0_RECEIVE_INTERRUPT)	
+    tmphead = (s->txHead + 1) & p->txMask;
+    if ( tmphead != s->txTail ) {
+        p->txBuf[tmphead] = data;
+        s->txHead = tmphead;
+        s->txBusy = 1;
+        *p->control |= _BV(UDRIE0);
+    }else{
+        s->txDropped++;
+    }
+
+}/* uart_echo */
+
+
+static inline void uart_rx_handler(const uart_port *p) __attribute__((always_inline));
 /*************************************************************************
-Function: UART Receive Complete interrupt
-Purpose:  called when the UART has received a character
+Function: uart_rx_handler()
+Purpose:  body of the Receive Complete interrupt, assembles complete
+          lines or SLIP frames into the line slots
+Input:    port
+Returns:  none
 **************************************************************************/
+static inline void uart_rx_handler(const uart_port *p)
 {
-    unsigned char tmphead;
+    uart_state *s = p->state;
     unsigned char data;
     unsigned char usr;
-    unsigned char lastRxError;
+    unsigned char flags;
+    unsigned char end = 0;
  
  
     /* read UART status register and UART data register */ 
-    usr  = UART0_STATUS;
-    data = UART0_DATA;
-    
-    /* */
-#if defined( AT90_UART )
-    lastRxError = (usr & (_BV(FE)|_BV(DOR)) );
-#elif defined( ATMEGA_USART )
-    lastRxError = (usr & (_BV(FE)|_BV(DOR)) );
-#elif defined( ATMEGA_USART0 )
-    lastRxError = (usr & (_BV(FE0)|_BV(DOR0)) );
-#elif defined ( ATMEGA_UART )
-    lastRxError = (usr & (_BV(FE)|_BV(DOR)) );
-#elif defined( AT90USB_USART )
-    lastRxError = (usr & (_BV(FE1)|_BV(DOR1)) );
-#endif
-        
-    /* calculate buffer index */ 
-    tmphead = ( UART_RxHead + 1) & UART_RX_BUFFER_MASK;
+    usr  = *p->status;
+    data = *p->data;
     
-    if ( tmphead == UART_RxTail ) {
-        /* error: receive buffer overflow */
-        lastRxError = UART_BUFFER_OVERFLOW >> 8;
+    s->lastRxError |= (usr & (_BV(FE0)|_BV(DOR0)) );
+
+    flags = s->rxFlags;
+    if ( flags & UART_RX_SLIP ) {
+        /* undo SLIP escaping, END terminates the frame */
+        if ( data == SLIP_END ) {
+            end = 1;
+        }else if ( data == SLIP_ESC ) {
+            s->rxFlags = flags | UART_RX_ESCAPE;
+            return;
+        }else if ( flags & UART_RX_ESCAPE ) {
+            s->rxFlags = flags & ~UART_RX_ESCAPE;
+            if ( data == SLIP_ESC_END ) data = SLIP_END;
+            else if ( data == SLIP_ESC_ESC ) data = SLIP_ESC;
+        }
     }else{
-        /* store new index */
-        UART_RxHead = tmphead;
-        /* store received data in buffer */
-        UART_RxBuf[tmphead] = data;
+        if ( flags & UART_RX_ECHO ) {
+            uart_echo(p, data);
+            if ( data == '\r' ) uart_echo(p, '\n');
+        }
+        /* CR or LF terminates the line, other control characters are dropped */
+        if ( (data == '\r') || (data == '\n') ) {
+            end = 1;
+        }else if ( (data < 0x20) || (data > 0x7E) ) {
+            return;
+        }
+    }
+
+    if ( end ) {
+        /* hand a complete, non-empty line over to the main loop */
+        if ( s->linePos && !(flags & UART_RX_DISCARD) ) {
+            p->lineBuf[s->lineHead * p->lineSize + s->linePos] = '\0';
+            p->lineLen[s->lineHead] = s->linePos;
+            s->lineHead = (s->lineHead + 1) & (p->lineSlots - 1);
+            s->linesReady++;
+        }
+        s->linePos = 0;
+        s->rxFlags &= ~(UART_RX_DISCARD | UART_RX_ESCAPE);
+    }else if ( !(flags & UART_RX_DISCARD) ) {
+        if ( (s->linesReady == p->lineSlots) || (s->linePos == p->lineSize - 1) ) {
+            /* error: no free slot or line too long, drop the whole line */
+            s->rxFlags |= UART_RX_DISCARD;
+            s->lastRxError |= UART_BUFFER_OVERFLOW >> 8;
+        }else{
+            p->lineBuf[s->lineHead * p->lineSize + s->linePos++] = data;
+        }
     }
-    UART_LastRxError |= lastRxError;   
-}
 
+}/* uart_rx_handler */
 
-ISR (UART0_TRANSMIT_INTERRUPT)
+
+static inline void uart_tx_handler(const uart_port *p) __attribute__((always_inline));
 /*************************************************************************
-Function: UART Data Register Empty interrupt
-Purpose:  called when the UART is ready to transmit the next byte
+Function: uart_tx_handler()
+Purpose:  body of the Data Register Empty interrupt, transmits the next
+          byte of the ringbuffer
+Input:    port
+Returns:  none
 **************************************************************************/
+static inline void uart_tx_handler(const uart_port *p)
 {
+    uart_state *s = p->state;
     unsigned char tmptail;
 
     
-    if ( UART_TxHead != UART_TxTail) {
+    if ( s->txHead != s->txTail) {
         /* calculate and store new buffer index */
-        tmptail = (UART_TxTail + 1) & UART_TX_BUFFER_MASK;
-        UART_TxTail = tmptail;
+        tmptail = (s->txTail + 1) & p->txMask;
+        s->txTail = tmptail;
         /* get one byte from buffer and write it to UART */
-        UART0_DATA = UART_TxBuf[tmptail];  /* start transmission */
+        *p->data = p->txBuf[tmptail];  /* start transmission */
     }else{
         /* tx buffer empty, disable UDRE interrupt */
-        UART0_CONTROL &= ~_BV(UART0_UDRIE);
+        *p->control &= ~_BV(UDRIE0);
+        /* the last byte just moved to the shift register, clear TXC so it
+           flags the end of this byte rather than of an earlier gap */
+        *p->status = (*p->status & _BV(U2X0)) | _BV(TXC0);
     }
+
+}/* uart_tx_handler */
+
+
+ISR (USART0_RX_vect)
+{
+    PROF_BEGIN(PROF_UART0_RX);
+    uart_rx_handler(&UART_Port[0]);
+    PROF_END(PROF_UART0_RX);
+}
+
+
+ISR (USART0_UDRE_vect)
+{
+    PROF_BEGIN(PROF_UART0_TX);
+    uart_tx_handler(&UART_Port[0]);
+    PROF_END(PROF_UART0_TX);
+}
+
+
+ISR (USART1_RX_vect)
+{
+    PROF_BEGIN(PROF_UART1_RX);
+    uart_rx_handler(&UART_Port[1]);
+    PROF_END(PROF_UART1_RX);
+}
+
+
+ISR (USART1_UDRE_vect)
+{
+    PROF_BEGIN(PROF_UART1_TX);
+    uart_tx_handler(&UART_Port[1]);
+    PROF_END(PROF_UART1_TX);
 }
 
 
+/*************************************************************************
+Function: uart_setrate()
+Purpose:  program the baud rate registers
+Input:    port, baudrate using macro UART_BAUD_SELECT()
+Returns:  none
+**************************************************************************/
+static void uart_setrate(const uart_port *p, unsigned int baudrate)
+{
+    if ( baudrate & 0x8000 ) 
+    {
+        *p->status = (1<<U2X0);  //Enable 2x speed 
+        baudrate &= ~0x8000;
+    }else{
+        *p->status = 0;
+    }
+    *p->ubrrh = (unsigned char)(baudrate>>8);
+    *p->ubrrl = (unsigned char) baudrate;
+
+}/* uart_setrate */
+
+
 /*************************************************************************
 Function: uart_init()
 Purpose:  initialize UART and set baudrate
-Input:    baudrate using macro UART_BAUD_SELECT()
+Input:    port, baudrate using macro UART_BAUD_SELECT()
 Returns:  none
 **************************************************************************/
-void uart_init(unsigned int baudrate)
+void uart_init(unsigned char port, unsigned int baudrate)
 {
-    UART_TxHead = 0;
-    UART_TxTail = 0;
-    UART_RxHead = 0;
-    UART_RxTail = 0;
-    
-#if defined( AT90_UART )
-    /* set baud rate */
-    UBRR = (unsigned char)baudrate; 
+    const uart_port *p = &UART_Port[port];
+    uart_state *s = p->state;
 
-    /* enable UART receiver and transmmitter and receive complete interrupt */
-    UART0_CONTROL = _BV(RXCIE)|_BV(RXEN)|_BV(TXEN);
 
-#elif defined (ATMEGA_USART)
-    /* Set baud rate */
-    if ( baudrate & 0x8000 )
-    {
-    	 UART0_STATUS = (1<<U2X);  //Enable 2x speed 
-    	 baudrate &= ~0x8000;
-    }
-    UBRRH = (unsigned char)(baudrate>>8);
-    UBRRL = (unsigned char) baudrate;
-   
-    /* Enable USART receiver and transmitter and receive complete interrupt */
-    UART0_CONTROL = _BV(RXCIE)|(1<<RXEN)|(1<<TXEN);
-    
-    /* Set frame format: asynchronous, 8data, no parity, 1stop bit */
-    #ifdef URSEL
-    UCSRC = (1<<URSEL)|(3<<UCSZ0);
-    #else
-    UCSRC = (3<<UCSZ0);
-    #endif 
-    
-#elif defined (ATMEGA_USART0 )
-    /* Set baud rate */
-    if ( baudrate & 0x8000 ) 
-    {
-   		UART0_STATUS = (1<<U2X0);  //Enable 2x speed 
-   		baudrate &= ~0x8000;
-   	}
-    UBRR0H = (unsigned char)(baudrate>>8);
-    UBRR0L = (unsigned char) baudrate;
+    s->txHead = 0;
+    s->txTail = 0;
+    s->txBusy = 0;
+    s->txPolicy = UART_TX_BLOCK;
+    s->txDropped = 0;
+    s->linesReady = 0;
+    s->lineHead = 0;
+    s->lineTail = 0;
+    s->linePos = 0;
+
+    uart_setrate(p, baudrate);
 
     /* Enable USART receiver and transmitter and receive complete interrupt */
-    UART0_CONTROL = _BV(RXCIE0)|(1<<RXEN0)|(1<<TXEN0);
+    *p->control = _BV(RXCIE0)|(1<<RXEN0)|(1<<TXEN0);
     
     /* Set frame format: asynchronous, 8data, no parity, 1stop bit */
-    #ifdef URSEL0
-    UCSR0C = (1<<URSEL0)|(3<<UCSZ00);
-    #else
-    UCSR0C = (3<<UCSZ00);
-    #endif 
-
-#elif defined ( ATMEGA_UART )
-    /* set baud rate */
-    if ( baudrate & 0x8000 ) 
-    {
-    	UART0_STATUS = (1<<U2X);  //Enable 2x speed 
-    	baudrate &= ~0x8000;
-    }
-    UBRRHI = (unsigned char)(baudrate>>8);
-    UBRR   = (unsigned char) baudrate;
+    *p->format = (3<<UCSZ00);
 
-    /* Enable UART receiver and transmitter and receive complete interrupt */
-    UART0_CONTROL = _BV(RXCIE)|(1<<RXEN)|(1<<TXEN);
+}/* uart_init */
 
-#elif defined ( AT90USB_USART )
-   /* set baud rate */
-    if ( baudrate & 0x8000 ) 
-    {
-    	UART0_STATUS = (1<<U2X1 );  //Enable 2x speed 
-    	baudrate &= ~0x8000;
+
+/*************************************************************************
+Function: uart_baudselect()
+Purpose:  find the baud rate register setting for a rate at run time,
+          using double speed mode where it comes closer
+Input:    baudrate in bps
+Returns:  value for uart_init() or uart_setbaud(), UART_BAUD_INVALID
+          if the rate is off by more than UART_BAUD_TOLERANCE
+**************************************************************************/
+unsigned int uart_baudselect(unsigned long baudrate)
+{
+    unsigned int best = UART_BAUD_INVALID;
+    unsigned long bestError = baudrate * UART_BAUD_TOLERANCE / 1000;
+    unsigned long actual;
+    unsigned long error;
+    unsigned long ubrr;
+    unsigned char divider;
+
+
+    /* the fastest rate is F_CPU/8, also keeps the error math in range */
+    if ( (baudrate == 0) || (baudrate > F_CPU / 8) ) {
+        return UART_BAUD_INVALID;
     }
-    UBRR1H = (unsigned char)(baudrate>>8);
-    UBRR1L = (unsigned char) baudrate;
 
-    /* Enable UART receiver and transmitter and receive complete interrupt */
-    UART0_CONTROL = _BV(RXCIE1)|(1<<RXEN1)|(1<<TXEN1);
-    
-    /* Set frame format: asynchronous, 8data, no parity, 1stop bit */
-    UCSR1C = (1<<UCSZ11)|(1<<UCSZ10);
-#endif
+    /* normal speed first, it samples each bit more often and wins a tie */
+    for ( divider = 16; divider >= 8; divider -= 8 ) {
+        ubrr = (F_CPU + divider / 2 * baudrate) / (divider * baudrate);
+        if ( ubrr == 0 ) continue;
+        ubrr--;
+        if ( ubrr > 0x0FFF ) continue;
+        actual = F_CPU / (divider * (ubrr + 1));
+        error = (actual > baudrate) ? actual - baudrate : baudrate - actual;
+        if ( (best == UART_BAUD_INVALID) ? (error <= bestError) : (error < bestError) ) {
+            best = (divider == 8) ? (ubrr | 0x8000) : ubrr;
+            bestError = error;
+        }
+    }
+    return best;
 
-}/* uart_init */
+}/* uart_baudselect */
 
 
 /*************************************************************************
-Function: uart_getc()
-Purpose:  return byte from ringbuffer  
-Returns:  lower byte:  received byte from ringbuffer
-          higher byte: last receive error
+Function: uart_setbaud()
+Purpose:  change the baud rate of a running port
+Input:    port, baudrate using macro UART_BAUD_SELECT() or uart_baudselect()
+Returns:  none
 **************************************************************************/
-unsigned int uart_getc(void)
-{    
-    unsigned char tmptail;
-    unsigned char data;
+void uart_setbaud(unsigned char port, unsigned int baudrate)
+{
+    const uart_port *p = &UART_Port[port];
+    uart_state *s = p->state;
+    unsigned char sreg = SREG;
+
+
+    cli();
+    uart_setrate(p, baudrate);
+    /* everything still queued was meant for the old rate */
+    *p->control &= ~_BV(UDRIE0);
+    s->txTail = s->txHead;
+    s->txBusy = 0;
+    s->linesReady = 0;
+    s->lineTail = s->lineHead;
+    s->linePos = 0;
+    s->rxFlags &= ~(UART_RX_DISCARD | UART_RX_ESCAPE);
+    SREG = sreg;
+
+}/* uart_setbaud */
+
+
+/*************************************************************************
+Function: uart_txfree()
+Purpose:  tell how much can be written without waiting or dropping
+Input:    port
+Returns:  free bytes in the transmit ringbuffer
+**************************************************************************/
+unsigned char uart_txfree(unsigned char port)
+{
+    const uart_port *p = &UART_Port[port];
+    uart_state *s = p->state;
+
+
+    return (s->txTail - s->txHead - 1) & p->txMask;
+
+}/* uart_txfree */
+
+
+/*************************************************************************
+Function: uart_txidle()
+Purpose:  tell whether everything written has left the transmitter
+Input:    port
+Returns:  nonzero once the ringbuffer and the shift register are empty
+**************************************************************************/
+unsigned char uart_txidle(unsigned char port)
+{
+    const uart_port *p = &UART_Port[port];
+    uart_state *s = p->state;
 
 
-    if ( UART_RxHead == UART_RxTail ) {
-        return UART_NO_DATA;   /* no data available */
+    if ( *p->control & _BV(UDRIE0) ) {
+        return 0;
     }
-    
-    /* calculate /store buffer index */
-    tmptail = (UART_RxTail + 1) & UART_RX_BUFFER_MASK;
-    UART_RxTail = tmptail; 
-    
-    /* get data from receive buffer */
-    data = UART_RxBuf[tmptail];
-    
-    data = (UART_LastRxError << 8) + data;
-    UART_LastRxError = 0;
-    return data;
+    if ( *p->status & _BV(TXC0) ) {
+        s->txBusy = 0;
+    }
+    return !s->txBusy;
 
-}/* uart_getc */
+}/* uart_txidle */
 
 
 /*************************************************************************
-Function: uart_putc()
-Purpose:  write byte to ringbuffer for transmitting via UART
-Input:    byte to be transmitted
-Returns:  none          
+Function: uart_getline()
+Purpose:  return the oldest complete line or frame received
+Input:    port, where to store the length of the line
+Returns:  pointer to the null terminated line, or 0 if none is ready
 **************************************************************************/
-void uart_putc(unsigned char data)
+unsigned char *uart_getline(unsigned char port, unsigned char *len)
 {
-    unsigned char tmphead;
+    const uart_port *p = &UART_Port[port];
+    uart_state *s = p->state;
 
-    
-    tmphead  = (UART_TxHead + 1) & UART_TX_BUFFER_MASK;
-    
-    while ( tmphead == UART_TxTail ){
-        ;/* wait for free space in buffer */
+
+    if ( s->linesReady == 0 ) {
+        return 0;   /* no line available */
     }
-    
-    UART_TxBuf[tmphead] = data;
-    UART_TxHead = tmphead;
+    *len = p->lineLen[s->lineTail];
+    return &p->lineBuf[s->lineTail * p->lineSize];
 
-    /* enable UDRE interrupt */
-    UART0_CONTROL    |= _BV(UART0_UDRIE);
+}/* uart_getline */
 
-}/* uart_putc */
+
+/*************************************************************************
+Function: uart_releaseline()
+Purpose:  hand the line returned by uart_getline() back to the receiver
+Input:    port
+Returns:  none
+**************************************************************************/
+void uart_releaseline(unsigned char port)
+{
+    const uart_port *p = &UART_Port[port];
+    uart_state *s = p->state;
+    unsigned char sreg = SREG;
+
+
+    if ( s->linesReady == 0 ) {
+        return;
+    }
+    s->lineTail = (s->lineTail + 1) & (p->lineSlots - 1);
+    cli();
+    s->linesReady--;
+    SREG = sreg;
+
+}/* uart_releaseline */
 
 
 /*************************************************************************
-Function: uart_puts()
-Purpose:  transmit string to UART
-Input:    string to be transmitted
-Returns:  none          
+Function: uart_available()
+Purpose:  tell whether a complete line or frame is waiting
+Input:    port
+Returns:  number of lines ready
 **************************************************************************/
-void uart_puts(const char *s )
+unsigned char uart_available(unsigned char port)
 {
-    while (*s) 
-      uart_putc(*s++);
+    return UART_State[port].linesReady;
 
-}/* uart_puts */
+}/* uart_available */
 
 
 /*************************************************************************
-Function: uart_puts_p()
-Purpose:  transmit string from program memory to UART
-Input:    program memory string to be transmitted
+Function: uart_rxerror()
+Purpose:  return and clear the receive errors seen since the last call
+Input:    port
+Returns:  UART_FRAME_ERROR, UART_OVERRUN_ERROR and UART_BUFFER_OVERFLOW bits
+**************************************************************************/
+unsigned int uart_rxerror(unsigned char port)
+{
+    uart_state *s = &UART_State[port];
+    unsigned char sreg = SREG;
+    unsigned char error;
+
+
+    cli();
+    error = s->lastRxError;
+    s->lastRxError = 0;
+    SREG = sreg;
+    return error << 8;
+
+}/* uart_rxerror */
+
+
+/*************************************************************************
+Function: uart_setmode()
+Purpose:  select how received data is split up
+Input:    port, UART_MODE_LINE for text lines, UART_MODE_SLIP for SLIP
+          frames, optionally or'ed with UART_MODE_ECHO to echo text lines
 Returns:  none
 **************************************************************************/
-void uart_puts_p(const char *progmem_s )
+void uart_setmode(unsigned char port, unsigned char mode)
 {
-    register char c;
-    
-    while ( (c = pgm_read_byte(progmem_s++)) ) 
-      uart_putc(c);
+    uart_state *s = &UART_State[port];
+    unsigned char sreg = SREG;
 
-}/* uart_puts_p */
 
+    cli();
+    /* restart reception, a partial line was framed the other way */
+    s->rxFlags = mode & (UART_RX_SLIP | UART_RX_ECHO);
+    s->linePos = 0;
+    SREG = sreg;
+
+}/* uart_setmode */
 
-/*
- * these functions are only for ATmegas with two USART
- */
-#if defined( ATMEGA_USART1 )
 
-ISR(UART1_RECEIVE_INTERRUPT)
 /*************************************************************************
-Function: UART1 Receive Complete interrupt
-Purpose:  called when the UART1 has received a character
+Function: uart_write_block()
+Purpose:  copy a block to the ringbuffer according to the transmit policy
+Input:    port, block, its length and whether it lives in program memory
+Returns:  number of bytes accepted
 **************************************************************************/
+static unsigned int uart_write_block(unsigned char port, const unsigned char *s, unsigned int len, unsigned char progmem)
 {
+    const uart_port *p = &UART_Port[port];
+    uart_state *st = p->state;
+    unsigned int done = 0;
+    unsigned int n;
+    unsigned char space;
     unsigned char tmphead;
-    unsigned char data;
-    unsigned char usr;
-    unsigned char lastRxError;
- 
- 
-    /* read UART status register and UART data register */ 
-    usr  = UART1_STATUS;
-    data = UART1_DATA;
-    
-    /* */
-    lastRxError = (usr & (_BV(FE1)|_BV(DOR1)) );
-        
-    /* calculate buffer index */ 
-    tmphead = ( UART1_RxHead + 1) & UART_RX_BUFFER_MASK;
-    
-    if ( tmphead == UART1_RxTail ) {
-        /* error: receive buffer overflow */
-        lastRxError = UART_BUFFER_OVERFLOW >> 8;
-    }else{
-        /* store new index */
-        UART1_RxHead = tmphead;
-        /* store received data in buffer */
-        UART1_RxBuf[tmphead] = data;
+    unsigned char sreg = SREG;
+
+
+    for (;;) {
+        /* the receive interrupt echoes into the same ringbuffer,
+           so copy with interrupts disabled */
+        cli();
+        space = (st->txTail - st->txHead - 1) & p->txMask;
+        n = len - done;
+        if ( n > space ) {
+            if ( (st->txPolicy == UART_TX_DROP) && (done == 0) ) {
+                n = 0;  /* all or nothing */
+            }else{
+                n = space;
+            }
+        }
+        tmphead = st->txHead;
+        done += n;
+        while ( n-- ) {
+            tmphead = (tmphead + 1) & p->txMask;
+            p->txBuf[tmphead] = progmem ? pgm_read_byte(s) : *s;
+            s++;
+        }
+        if ( tmphead != st->txHead ) {
+            st->txHead = tmphead;
+            st->txBusy = 1;
+            /* enable UDRE interrupt */
+            *p->control |= _BV(UDRIE0);
+        }
+        if ( (done == len) || (st->txPolicy != UART_TX_BLOCK) ) break;
+        SREG = sreg;
+
+        /* wait for free space in buffer */
+        halWait();
     }
-    UART1_LastRxError |= lastRxError;   
-}
+
+    /* the receive interrupt counts its dropped echoes here as well */
+    st->txDropped += len - done;
+    SREG = sreg;
+    return done;
+
+}/* uart_write_block */
 
 
-ISR(UART1_TRANSMIT_INTERRUPT)
 /*************************************************************************
-Function: UART1 Data Register Empty interrupt
-Purpose:  called when the UART1 is ready to transmit the next byte
+Function: uart_write()
+Purpose:  write a block to ringbuffer for transmitting via UART
+Input:    port, block to be transmitted and its length
+Returns:  number of bytes accepted, see uart_settxpolicy()
 **************************************************************************/
+unsigned int uart_write(unsigned char port, const unsigned char *buf, unsigned int len)
 {
-    unsigned char tmptail;
+    return uart_write_block(port, buf, len, 0);
 
-    
-    if ( UART1_TxHead != UART1_TxTail) {
-        /* calculate and store new buffer index */
-        tmptail = (UART1_TxTail + 1) & UART_TX_BUFFER_MASK;
-        UART1_TxTail = tmptail;
-        /* get one byte from buffer and write it to UART */
-        UART1_DATA = UART1_TxBuf[tmptail];  /* start transmission */
-    }else{
-        /* tx buffer empty, disable UDRE interrupt */
-        UART1_CONTROL &= ~_BV(UART1_UDRIE);
-    }
-}
+}/* uart_write */
 
 
 /*************************************************************************
-Function: uart1_init()
-Purpose:  initialize UART1 and set baudrate
-Input:    baudrate using macro UART_BAUD_SELECT()
-Returns:  none
+Function: uart_write_p()
+Purpose:  write a block from program memory to ringbuffer
+Input:    port, program memory block to be transmitted and its length
+Returns:  number of bytes accepted, see uart_settxpolicy()
 **************************************************************************/
-void uart1_init(unsigned int baudrate)
+unsigned int uart_write_p(unsigned char port, const unsigned char *progmem_buf, unsigned int len)
 {
-    UART1_TxHead = 0;
-    UART1_TxTail = 0;
-    UART1_RxHead = 0;
-    UART1_RxTail = 0;
-    
+    return uart_write_block(port, progmem_buf, len, 1);
 
-    /* Set baud rate */
-    if ( baudrate & 0x8000 ) 
-    {
-    	UART1_STATUS = (1<<U2X1);  //Enable 2x speed 
-      baudrate &= ~0x8000;
-    }
-    UBRR1H = (unsigned char)(baudrate>>8);
-    UBRR1L = (unsigned char) baudrate;
-
-    /* Enable USART receiver and transmitter and receive complete interrupt */
-    UART1_CONTROL = _BV(RXCIE1)|(1<<RXEN1)|(1<<TXEN1);
-    
-    /* Set frame format: asynchronous, 8data, no parity, 1stop bit */   
-    #ifdef URSEL1
-    UCSR1C = (1<<URSEL1)|(3<<UCSZ10);
-    #else
-    UCSR1C = (3<<UCSZ10);
-    #endif 
-}/* uart_init */
+}/* uart_write_p */
 
 
 /*************************************************************************
-Function: uart1_getc()
-Purpose:  return byte from ringbuffer  
-Returns:  lower byte:  received byte from ringbuffer
-          higher byte: last receive error
+Function: uart_settxpolicy()
+Purpose:  select what writes do when the ringbuffer is full
+Input:    port, UART_TX_BLOCK, UART_TX_TRUNCATE or UART_TX_DROP
+Returns:  the previous policy
 **************************************************************************/
-unsigned int uart1_getc(void)
-{    
-    unsigned char tmptail;
-    unsigned char data;
+unsigned char uart_settxpolicy(unsigned char port, unsigned char policy)
+{
+    unsigned char old = UART_State[port].txPolicy;
 
 
-    if ( UART1_RxHead == UART1_RxTail ) {
-        return UART_NO_DATA;   /* no data available */
-    }
-    
-    /* calculate /store buffer index */
-    tmptail = (UART1_RxTail + 1) & UART_RX_BUFFER_MASK;
-    UART1_RxTail = tmptail; 
-    
-    /* get data from receive buffer */
-    data = UART1_RxBuf[tmptail];
-    
-    data = (UART1_LastRxError << 8) + data;
-    UART1_LastRxError = 0;
-    return data;
+    UART_State[port].txPolicy = policy;
+    return old;
 
-}/* uart1_getc */
+}/* uart_settxpolicy */
 
 
 /*************************************************************************
-Function: uart1_putc()
-Purpose:  write byte to ringbuffer for transmitting via UART
-Input:    byte to be transmitted
-Returns:  none          
+Function: uart_txdropped()
+Purpose:  return the number of bytes dropped for lack of buffer space
+Input:    port
+Returns:  free running count of dropped bytes
 **************************************************************************/
-void uart1_putc(unsigned char data)
+unsigned int uart_txdropped(unsigned char port)
 {
-    unsigned char tmphead;
+    unsigned char sreg = SREG;
+    unsigned int dropped;
 
-    
-    tmphead  = (UART1_TxHead + 1) & UART_TX_BUFFER_MASK;
-    
-    while ( tmphead == UART1_TxTail ){
-        ;/* wait for free space in buffer */
-    }
-    
-    UART1_TxBuf[tmphead] = data;
-    UART1_TxHead = tmphead;
 
-    /* enable UDRE interrupt */
-    UART1_CONTROL    |= _BV(UART1_UDRIE);
+    cli();
+    dropped = UART_State[port].txDropped;
+    SREG = sreg;
+    return dropped;
 
-}/* uart1_putc */
+}/* uart_txdropped */
 
 
 /*************************************************************************
-Function: uart1_puts()
-Purpose:  transmit string to UART1
-Input:    string to be transmitted
+Function: uart_putc()
+Purpose:  write byte to ringbuffer for transmitting via UART
+Input:    port, byte to be transmitted
 Returns:  none          
 **************************************************************************/
-void uart1_puts(const char *s )
+void uart_putc(unsigned char port, unsigned char data)
 {
-    while (*s) 
-      uart1_putc(*s++);
+    uart_write_block(port, &data, 1, 0);
 
-}/* uart1_puts */
+}/* uart_putc */
 
 
 /*************************************************************************
-Function: uart1_puts_p()
-Purpose:  transmit string from program memory to UART1
-Input:    program memory string to be transmitted
-Returns:  none
+Function: uart_puts()
+Purpose:  transmit string to UART
+Input:    port, string to be transmitted
+Returns:  none          
 **************************************************************************/
-void uart1_puts_p(const char *progmem_s )
+void uart_puts(unsigned char port, const char *s )
 {
-    register char c;
-    
-    while ( (c = pgm_read_byte(progmem_s++)) ) 
-      uart1_putc(c);
+    uart_write_block(port, (const unsigned char *)s, strlen(s), 0);
 
-}/* uart1_puts_p */
+}/* uart_puts */
 
 
-#endif
+/*************************************************************************
+Function: uart_puts_p()
+Purpose:  transmit string from program memory to UART
+Input:    port, program memory string to be transmitted
+Returns:  none
+**************************************************************************/
+void uart_puts_p(unsigned char port, const char *progmem_s )
+{
+    uart_write_block(port, (const unsigned char *)progmem_s, strlen_P(progmem_s), 1);
+
+}/* uart_puts_p */
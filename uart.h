@@ -5,7 +5,7 @@ Title:    Interrupt UART library with receive/transmit circular buffers
 Author:   Peter Fleury <pfleury@gmx.ch>   http://jump.to/fleury
 File:     $Id: uart.h,v 1.12 2012/11/19 19:52:27 peter Exp $
 Software: AVR-GCC 4.1, AVR Libc 1.4
-Hardware: any AVR with built-in UART, tested on AT90S8515 & ATmega8 at 4 Mhz
+Hardware: ATmega with two USARTs, such as the ATmega324PA
 License:  GNU General Public License 
 Usage:    see Doxygen manual
 
@@ -36,10 +36,19 @@ LICENSE:
  *  receiving a byte. The interrupt handling routines use circular buffers
  *  for buffering received and transmitted data.
  *
- *  The UART_RX_BUFFER_SIZE and UART_TX_BUFFER_SIZE constants define
- *  the size of the circular buffers in bytes. Note that these constants must be a power of 2.
+ *  Received data is assembled into complete lines (or SLIP frames) by the
+ *  receive interrupt and handed to the application a whole line at a time
+ *  through uart_getline() and uart_releaseline().
+ *
+ *  Both USARTs are served by the same code, every function takes the port
+ *  number, UART_PORT0 or UART_PORT1, as its first argument.
+ *
+ *  Buffers are sized per port. UARTn_TX_BUFFER_SIZE defines the size of the
+ *  circular transmit buffer of port n in bytes, UARTn_LINE_SLOTS the number
+ *  of receive line slots and UARTn_LINE_SIZE the size of each slot. The first
+ *  two must be a power of 2.
  *  You may need to adapt this constants to your target and your application by adding 
- *  CDEFS += -DUART_RX_BUFFER_SIZE=nn -DUART_RX_BUFFER_SIZE=nn to your Makefile.
+ *  CDEFS += -DUART0_TX_BUFFER_SIZE=nn -DUART0_LINE_SIZE=nn to your Makefile.
  *
  *  @note Based on Atmel Application Note AVR306
  *  @author Peter Fleury pfleury@gmx.ch  http://jump.to/fleury
@@ -70,28 +79,65 @@ LICENSE:
 #define UART_BAUD_SELECT_DOUBLE_SPEED(baudRate,xtalCpu) ( ((((xtalCpu) + 4UL * (baudRate)) / (8UL * (baudRate)) -1UL)) | 0x8000)
 
 
-/** Size of the circular receive buffer, must be power of 2 */
-#ifndef UART_RX_BUFFER_SIZE
-#define UART_RX_BUFFER_SIZE 32
+/** @brief  Largest baud rate error accepted by uart_baudselect(), in 1/1000 */
+#define UART_BAUD_TOLERANCE   20
+/** @brief  Returned by uart_baudselect() for rates that can not be met */
+#define UART_BAUD_INVALID     0xFFFF
+
+/** @brief  Port numbers */
+#define UART_PORT0            0
+#define UART_PORT1            1
+#define UART_PORTS            2
+
+/** Size of the circular transmit buffers, must be power of 2 */
+#ifndef UART0_TX_BUFFER_SIZE
+#define UART0_TX_BUFFER_SIZE 32
+#endif
+#ifndef UART1_TX_BUFFER_SIZE
+#define UART1_TX_BUFFER_SIZE 32
 #endif
-/** Size of the circular transmit buffer, must be power of 2 */
-#ifndef UART_TX_BUFFER_SIZE
-#define UART_TX_BUFFER_SIZE 32
+/** Number of receive line slots, must be power of 2 */
+#ifndef UART0_LINE_SLOTS
+#define UART0_LINE_SLOTS 2
+#endif
+#ifndef UART1_LINE_SLOTS
+#define UART1_LINE_SLOTS 2
+#endif
+/** Size of a receive line slot including the null terminator, at most 255 */
+#ifndef UART0_LINE_SIZE
+#define UART0_LINE_SIZE 64
+#endif
+#ifndef UART1_LINE_SIZE
+#define UART1_LINE_SIZE 64
 #endif
 
-/* test if the size of the circular buffers fits into SRAM */
-#if ( (UART_RX_BUFFER_SIZE+UART_TX_BUFFER_SIZE) >= (RAMEND-0x60 ) )
-#error "size of UART_RX_BUFFER_SIZE + UART_TX_BUFFER_SIZE larger than size of SRAM"
+/* test if the size of the buffers fits into SRAM */
+#if ( (UART0_LINE_SLOTS*UART0_LINE_SIZE+UART0_TX_BUFFER_SIZE \
+      +UART1_LINE_SLOTS*UART1_LINE_SIZE+UART1_TX_BUFFER_SIZE) >= (RAMEND-0x60 ) )
+#error "size of the UART line slots and TX buffers larger than size of SRAM"
 #endif
 
+/** @brief  Receive mode for text lines terminated by CR or LF @see uart_setmode */
+#define UART_MODE_LINE        0x00
+/** @brief  Receive mode for SLIP frames @see uart_setmode */
+#define UART_MODE_SLIP        0x01
+/** @brief  Echo received text, or'ed with UART_MODE_LINE @see uart_setmode */
+#define UART_MODE_ECHO        0x02
+
+/** @brief  Writes wait for space in the ringbuffer @see uart_settxpolicy */
+#define UART_TX_BLOCK         0
+/** @brief  Writes send what fits and drop the rest @see uart_settxpolicy */
+#define UART_TX_TRUNCATE      1
+/** @brief  Writes that do not fit completely are dropped @see uart_settxpolicy */
+#define UART_TX_DROP          2
+
 /* 
-** high byte error return code of uart_getc()
+** error bits returned by uart_rxerror()
 */
 #define UART_FRAME_ERROR      0x1000              /* Framing Error by UART       */
 #define UART_OVERRUN_ERROR    0x0800              /* Overrun condition by UART   */
 #define UART_PARITY_ERROR     0x0400              /* Parity Error by UART        */ 
-#define UART_BUFFER_OVERFLOW  0x0200              /* receive ringbuffer overflow */
-#define UART_NO_DATA          0x0100              /* no receive data available   */
+#define UART_BUFFER_OVERFLOW  0x0200              /* line dropped, no free slot or too long */
 
 
 /*
@@ -100,29 +146,96 @@ LICENSE:
 
 /**
    @brief   Initialize UART and set baudrate 
+   @param   port UART_PORT0 or UART_PORT1
    @param   baudrate Specify baudrate using macro UART_BAUD_SELECT()
    @return  none
 */
-extern void uart_init(unsigned int baudrate);
+extern void uart_init(unsigned char port, unsigned int baudrate);
+
+
+/**
+ *  @brief   Find the baud rate setting for a rate at run time
+ *
+ *  Normal and double speed mode are both tried and the closer one is
+ *  taken, normal speed if both are equally close. At 20 MHz the rates
+ *  250000, 625000, 1250000 (normal) and 500000 (double speed) are exact,
+ *  1000000 can not be met and is rejected.
+ *
+ *  @param   baudrate rate in bps
+ *  @return  value for uart_init() or uart_setbaud(), or UART_BAUD_INVALID
+ *           if no setting is within UART_BAUD_TOLERANCE
+ */
+extern unsigned int uart_baudselect(unsigned long baudrate);
+
+
+/**
+ *  @brief   Change the baud rate of a running port
+ *
+ *  Data still being sent or received is garbled, wait for uart_txidle()
+ *  first. Whatever is still queued for sending, the lines not yet
+ *  fetched and any partially received line or frame are discarded.
+ *
+ *  @param   port UART_PORT0 or UART_PORT1
+ *  @param   baudrate Specify baudrate using macro UART_BAUD_SELECT() or uart_baudselect()
+ *  @return  none
+ */
+extern void uart_setbaud(unsigned char port, unsigned int baudrate);
+
+
+/**
+ *  @brief   Tell whether everything written has been sent
+ *  @param   port UART_PORT0 or UART_PORT1
+ *  @return  nonzero once the ringbuffer and the transmit shift register are empty
+ */
+extern unsigned char uart_txidle(unsigned char port);
 
 
 /**
- *  @brief   Get received byte from ringbuffer
+ *  @brief   Tell how much can be written without waiting or dropping
+ *  @param   port UART_PORT0 or UART_PORT1
+ *  @return  free bytes in the transmit ringbuffer, echo may take some
+ */
+extern unsigned char uart_txfree(unsigned char port);
+
+
+/**
+ *  @brief   Get the oldest complete line received
+ *
+ *  In UART_MODE_LINE a line is the printable text up to a CR or LF, in
+ *  UART_MODE_SLIP it is the unescaped content of a SLIP frame. Empty lines
+ *  are never returned. The line stays valid until uart_releaseline().
  *
- * Returns in the lower byte the received character and in the 
- * higher byte the last receive error.
- * UART_NO_DATA is returned when no data is available.
+ *  @param   port UART_PORT0 or UART_PORT1
+ *  @param   len where to store the length of the line
+ *  @return  pointer to the null terminated line, or 0 if none is ready
+ */
+extern unsigned char *uart_getline(unsigned char port, unsigned char *len);
+
+
+/**
+ *  @brief   Hand the line returned by uart_getline() back to the receiver
+ *  @param   port UART_PORT0 or UART_PORT1
+ *  @return  none
+ */
+extern void uart_releaseline(unsigned char port);
+
+
+/**
+ *  @brief   Number of complete lines waiting
+ *  @param   port UART_PORT0 or UART_PORT1
+ *  @return  number of lines ready to be fetched with uart_getline()
+ */
+extern unsigned char uart_available(unsigned char port);
+
+
+/**
+ *  @brief   Get and clear the receive errors seen since the last call
  *
- *  @param   void
- *  @return  lower byte:  received byte from ringbuffer
- *  @return  higher byte: last receive status
- *           - \b 0 successfully received data from UART
- *           - \b UART_NO_DATA           
- *             <br>no receive data available
+ *  @param   port UART_PORT0 or UART_PORT1
+ *  @return  error bits
  *           - \b UART_BUFFER_OVERFLOW   
- *             <br>Receive ringbuffer overflow.
- *             We are not reading the receive buffer fast enough, 
- *             one or more received character have been dropped 
+ *             <br>A line was dropped, either because all line slots were
+ *             still in use or because it did not fit into a slot.
  *           - \b UART_OVERRUN_ERROR     
  *             <br>Overrun condition by UART.
  *             A character already present in the UART UDR register was 
@@ -131,15 +244,79 @@ extern void uart_init(unsigned int baudrate);
  *           - \b UART_FRAME_ERROR       
  *             <br>Framing Error by UART
  */
-extern unsigned int uart_getc(void);
+extern unsigned int uart_rxerror(unsigned char port);
+
+
+/**
+ *  @brief   Select how received data is split into lines
+ *
+ *  Any partially received line is discarded.
+ *
+ *  @param   port UART_PORT0 or UART_PORT1
+ *  @param   mode UART_MODE_LINE or UART_MODE_SLIP, UART_MODE_LINE may be
+ *           or'ed with UART_MODE_ECHO
+ *  @return  none
+ */
+extern void uart_setmode(unsigned char port, unsigned char mode);
+
+
+/**
+ *  @brief   Write a block to ringbuffer for transmitting via UART
+ *
+ *  The block is copied into the circular buffer in one go and transmitted
+ *  one byte at a time using interrupts. What happens when it does not fit
+ *  is decided by the transmit policy, see uart_settxpolicy(). Bytes not
+ *  accepted are counted, see uart_txdropped().
+ *
+ *  @param   port UART_PORT0 or UART_PORT1
+ *  @param   buf block to be transmitted
+ *  @param   len length of the block
+ *  @return  number of bytes accepted
+ */
+extern unsigned int uart_write(unsigned char port, const unsigned char *buf, unsigned int len);
+
+
+/**
+ *  @brief   Write a block from program memory to ringbuffer
+ *  @param   port UART_PORT0 or UART_PORT1
+ *  @param   progmem_buf program memory block to be transmitted
+ *  @param   len length of the block
+ *  @return  number of bytes accepted
+ *  @see     uart_write
+ */
+extern unsigned int uart_write_p(unsigned char port, const unsigned char *progmem_buf, unsigned int len);
+
+
+/**
+ *  @brief   Select what writes do when the ringbuffer is full
+ *
+ *  - \b UART_TX_BLOCK waits for the interrupt to make room, the default.
+ *  - \b UART_TX_TRUNCATE sends what fits and drops the rest.
+ *  - \b UART_TX_DROP drops a write that does not fit completely.
+ *
+ *  @param   port UART_PORT0 or UART_PORT1
+ *  @param   policy UART_TX_BLOCK, UART_TX_TRUNCATE or UART_TX_DROP
+ *  @return  the previous policy
+ */
+extern unsigned char uart_settxpolicy(unsigned char port, unsigned char policy);
+
+
+/**
+ *  @brief   Number of bytes dropped for lack of ringbuffer space
+ *  @param   port UART_PORT0 or UART_PORT1
+ *  @return  free running count of dropped bytes, echo included
+ */
+extern unsigned int uart_txdropped(unsigned char port);
 
 
 /**
  *  @brief   Put byte to ringbuffer for transmitting via UART
+ *  @param   port UART_PORT0 or UART_PORT1
  *  @param   data byte to be transmitted
  *  @return  none
+ *  @see     uart_write
  */
-extern void uart_putc(unsigned char data);
+extern void uart_putc(unsigned char port, unsigned char data);
 
 
 /**
@@ -147,12 +324,14 @@ extern void uart_putc(unsigned char data);
  *
  *  The string is buffered by the uart library in a circular buffer
  *  and one character at a time is transmitted to the UART using interrupts.
- *  Blocks if it can not write the whole string into the circular buffer.
+ *  The whole string is written as one block, subject to the transmit policy.
  * 
+ *  @param   port UART_PORT0 or UART_PORT1
  *  @param   s string to be transmitted
  *  @return  none
+ *  @see     uart_write
  */
-extern void uart_puts(const char *s );
+extern void uart_puts(unsigned char port, const char *s );
 
 
 /**
@@ -160,36 +339,21 @@ extern void uart_puts(const char *s );
  *
  * The string is buffered by the uart library in a circular buffer
  * and one character at a time is transmitted to the UART using interrupts.
- * Blocks if it can not write the whole string into the circular buffer.
+ * The whole string is written as one block, subject to the transmit policy.
  *
+ * @param    port UART_PORT0 or UART_PORT1
  * @param    s program memory string to be transmitted
  * @return   none
  * @see      uart_puts_P
  */
-extern void uart_puts_p(const char *s );
+extern void uart_puts_p(unsigned char port, const char *s );
 
 /**
  * @brief    Macro to automatically put a string constant into program memory
  */
-#define uart_puts_P(__s)       uart_puts_p(PSTR(__s))
-
-
-
-/** @brief  Initialize USART1 (only available on selected ATmegas) @see uart_init */
-extern void uart1_init(unsigned int baudrate);
-/** @brief  Get received byte of USART1 from ringbuffer. (only available on selected ATmega) @see uart_getc */
-extern unsigned int uart1_getc(void);
-/** @brief  Put byte to ringbuffer for transmitting via USART1 (only available on selected ATmega) @see uart_putc */
-extern void uart1_putc(unsigned char data);
-/** @brief  Put string to ringbuffer for transmitting via USART1 (only available on selected ATmega) @see uart_puts */
-extern void uart1_puts(const char *s );
-/** @brief  Put string from program memory to ringbuffer for transmitting via USART1 (only available on selected ATmega) @see uart_puts_p */
-extern void uart1_puts_p(const char *s );
-/** @brief  Macro to automatically put a string constant into program memory */
-#define uart1_puts_P(__s)       uart1_puts_p(PSTR(__s))
+#define uart_puts_P(__port, __s)       uart_puts_p(__port, PSTR(__s))
 
 /**@}*/
 
 
 #endif // UART_H 
-